@@ -0,0 +1,195 @@
+/*
+ * Asynchronous block I/O benchmark
+ *
+ * Measure random block I/O throughput on an image file, with synchronous
+ * block_read()/block_write() and with asynchronous queues at depths 1 to 64.
+ * With -d, the image is opened with O_DIRECT so that the host's page cache
+ * doesn't absorb the I/O. Results are printed as CSV on stdout.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "disk.h"
+
+#define die(fmt, ...) do { \
+	fprintf(stderr, "bench_aio: "fmt"\n", ##__VA_ARGS__); \
+	exit(1); \
+} while (0)
+
+#define MAX_DEPTH 64
+
+static size_t nblocks;
+static unsigned long ops;
+static int do_write;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *engine, unsigned depth, double secs)
+{
+	printf("%s,%s,%u,%lu,%.6f,%.0f,%.2f\n", engine,
+	       do_write ? "write" : "read", depth, ops, secs, ops / secs,
+	       ops * (double)BLOCK_SIZE / secs / (1 << 20));
+}
+
+/* Create an image of @size blocks, with all its blocks allocated */
+static void make_image(const char *path, size_t size)
+{
+	char buf[BLOCK_SIZE];
+	size_t i;
+	int fd;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		die("cannot create %s: %s", path, strerror(errno));
+
+	memset(buf, 0xa5, sizeof(buf));
+	for (i = 0; i < size; i++)
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+			die("cannot write %s: %s", path, strerror(errno));
+
+	close(fd);
+}
+
+static void bench_sync(char *bufs)
+{
+	unsigned long i;
+	size_t block;
+	double start;
+	int ret;
+
+	start = now();
+	for (i = 0; i < ops; i++) {
+		block = random() % nblocks;
+		if (do_write)
+			ret = block_write(block, bufs);
+		else
+			ret = block_read(block, bufs);
+		if (ret)
+			die("block I/O failed");
+	}
+	report("sync", 1, now() - start);
+}
+
+static void bench_queue(enum block_queue_backend backend, unsigned depth,
+			char *bufs)
+{
+	struct block_io ios[MAX_DEPTH], *done[MAX_DEPTH], *unused[MAX_DEPTH];
+	struct block_queue *q;
+	unsigned long issued = 0, completed = 0;
+	int i, n, nunused = depth;
+	double start;
+
+	/* io_uring may not be available on this kernel */
+	if (!(q = block_queue_create(depth, backend))) {
+		fprintf(stderr, "bench_aio: skipping backend %d\n", backend);
+		return;
+	}
+
+	for (i = 0; i < (int)depth; i++) {
+		ios[i].buf = bufs + i * BLOCK_SIZE;
+		ios[i].count = 1;
+		ios[i].write = do_write;
+		unused[i] = &ios[i];
+	}
+
+	/* Keep @depth requests in flight */
+	start = now();
+	while (completed < ops) {
+		while (nunused && issued < ops) {
+			struct block_io *io = unused[--nunused];
+
+			io->block = random() % nblocks;
+			if (block_queue_add(q, io))
+				die("cannot queue request");
+			issued++;
+		}
+		if (block_queue_submit(q) < 0)
+			die("cannot submit requests");
+
+		n = block_queue_reap(q, done, MAX_DEPTH, 1);
+		for (i = 0; i < n; i++) {
+			if (done[i]->result)
+				die("block I/O failed");
+			unused[nunused++] = done[i];
+		}
+		completed += n;
+	}
+	report(block_queue_backend(q) == BLOCK_QUEUE_URING ?
+	       "io_uring" : "threads", depth, now() - start);
+
+	block_queue_destroy(q);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: bench_aio.x [-f image] [-s size_mib] "
+		"[-n ops] [-w] [-d]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = "bench_aio.img";
+	enum block_disk_mode mode = BLOCK_DISK_FILE;
+	size_t size_mib = 64;
+	unsigned depth;
+	char *bufs;
+	int opt;
+
+	ops = 20000;
+	while ((opt = getopt(argc, argv, "f:s:n:wd")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 's':
+			size_mib = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			do_write = 1;
+			break;
+		case 'd':
+			mode = BLOCK_DISK_DIRECT;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!size_mib || !ops)
+		usage();
+
+	nblocks = size_mib * (1 << 20) / BLOCK_SIZE;
+	make_image(path, nblocks);
+	if (block_disk_open_mode(path, mode))
+		die("cannot open %s", path);
+
+	if (posix_memalign((void **)&bufs, BLOCK_SIZE, MAX_DEPTH * BLOCK_SIZE))
+		die("cannot allocate buffers");
+
+	srandom(1);
+	printf("engine,op,depth,ops,seconds,iops,mib_per_s\n");
+	bench_sync(bufs);
+	for (depth = 1; depth <= MAX_DEPTH; depth *= 2)
+		bench_queue(BLOCK_QUEUE_URING, depth, bufs);
+	for (depth = 1; depth <= MAX_DEPTH; depth *= 2)
+		bench_queue(BLOCK_QUEUE_THREADS, depth, bufs);
+
+	free(bufs);
+	block_disk_close();
+	unlink(path);
+
+	return 0;
+}
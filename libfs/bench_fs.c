@@ -0,0 +1,595 @@
+/*
+ * File system benchmark
+ *
+ * Format image files and measure, through the file system API:
+ * - sequential and random read/write throughput, for several chunk sizes
+ * - create/open/stat/close/delete latency as the root directory fills up and
+ *   drains
+ * - mount/umount time, on an empty and on a full root directory
+ * - creating and deleting a full root directory of files one call at a time,
+ *   then in a single fs_batch()
+ * - writing and reading small records one call per record, then many records
+ *   per fs_writev() or fs_readv()
+ * - sequential reads of a file fragmented over many holes, before and after
+ *   fs_defrag()
+ *
+ * Results are printed on stdout, as CSV or as a JSON array, with the same
+ * fields either way.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "disk.h"
+#include "fs.h"
+
+#define die(fmt, ...) do { \
+	fprintf(stderr, "bench_fs: "fmt"\n", ##__VA_ARGS__); \
+	exit(1); \
+} while (0)
+
+/* Largest number of data blocks a volume can have */
+#define MAX_DATA_BLOCKS 65000
+
+/* Number of files measured together in metadata latency results */
+#define META_BUCKET 16
+
+/* Number of times mount and unmount are measured */
+#define MOUNT_ROUNDS 20
+
+/* Number of times a full root directory is created and deleted */
+#define BATCH_ROUNDS 20
+
+/* Vectored I/O: size of the records, and records per call */
+#define VEC_RECORD 1000
+#define VEC_RECORDS 64
+
+/* Fragmented volume: files filling it, and blocks of each */
+#define FRAG_FILES 126
+#define FRAG_HOLE_BLOCKS 8
+
+static const size_t chunks[] = { 512, 4096, 65536, 1 << 20 };
+
+static const char *path = "bench_fs.img";
+static struct fs_options opts = { .cache_blocks = FS_CACHE_BLOCKS };
+static size_t file_size;
+static int json;
+static int nresults;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Print a result: @ops operations of benchmark @bench, transferring @bytes in
+ * total (0 for metadata operations), took @secs
+ */
+static void report(const char *bench, const char *op, size_t chunk,
+		   int files, unsigned long ops, size_t bytes, double secs)
+{
+	double mibs = bytes / secs / (1 << 20);
+	double usecs = secs * 1e6 / ops;
+
+	if (!json) {
+		if (!nresults++)
+			printf("bench,op,chunk,files,ops,seconds,mib_per_s,"
+			       "us_per_op\n");
+		printf("%s,%s,%zu,%d,%lu,%.6f,%.2f,%.3f\n", bench, op, chunk,
+		       files, ops, secs, mibs, usecs);
+		return;
+	}
+
+	printf("%s\n  {\"bench\": \"%s\", \"op\": \"%s\", \"chunk\": %zu, "
+	       "\"files\": %d, \"ops\": %lu, \"seconds\": %.6f, "
+	       "\"mib_per_s\": %.2f, \"us_per_op\": %.3f}",
+	       nresults++ ? "," : "[", bench, op, chunk, files, ops, secs, mibs,
+	       usecs);
+}
+
+/* Write an empty volume of @ndata data blocks to @path */
+static void make_volume(size_t ndata)
+{
+	size_t nfat = (ndata * 2 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	size_t total = 2 + nfat + ndata;
+	uint8_t block[BLOCK_SIZE];
+	uint16_t *fields = (uint16_t *)(block + 8);
+	FILE *f;
+
+	if (!(f = fopen(path, "wb")))
+		die("cannot create %s: %s", path, strerror(errno));
+
+	/* Superblock */
+	memset(block, 0, sizeof(block));
+	memcpy(block, "ECS150FS", 8);
+	fields[0] = total;
+	fields[1] = 1 + nfat;
+	fields[2] = 2 + nfat;
+	fields[3] = ndata;
+	block[16] = nfat;
+	fwrite(block, sizeof(block), 1, f);
+
+	/* FAT, whose first entry is never used, and root directory */
+	memset(block, 0, sizeof(block));
+	block[0] = block[1] = 0xff;
+	fwrite(block, sizeof(block), 1, f);
+	block[0] = block[1] = 0;
+	for (size_t i = 1; i < nfat + 1; i++)
+		fwrite(block, sizeof(block), 1, f);
+
+	/* Data blocks don't need to be written */
+	if (fflush(f) || ftruncate(fileno(f), total * BLOCK_SIZE))
+		die("cannot write %s: %s", path, strerror(errno));
+	fclose(f);
+}
+
+static fs_t *vol_mount(void)
+{
+	fs_t *fs;
+
+	if (!(fs = fs_mount_ex(path, &opts)))
+		die("cannot mount %s", path);
+
+	return fs;
+}
+
+static void vol_umount(fs_t *fs)
+{
+	if (fs_umount_ex(fs))
+		die("cannot unmount %s", path);
+}
+
+static int open_file(fs_t *fs, const char *name)
+{
+	int fd;
+
+	if ((fd = fs_open_ex(fs, name)) < 0)
+		die("cannot open %s", name);
+
+	return fd;
+}
+
+/* Transfer @chunk bytes at a time over the whole file, in order or randomly */
+static void bench_io(const char *op, size_t chunk, int write, int random)
+{
+	unsigned long ops = file_size / chunk, i;
+	double start, secs;
+	char *buf;
+	fs_t *fs;
+	int fd;
+
+	if (!(buf = malloc(chunk)))
+		die("cannot allocate memory");
+	memset(buf, 0x5a, chunk);
+
+	/* Each pass starts with a cold block cache */
+	fs = vol_mount();
+	fd = open_file(fs, "data");
+
+	start = now();
+	for (i = 0; i < ops; i++) {
+		if (random &&
+		    fs_lseek_ex(fs, fd, (size_t)(rand() % ops) * chunk))
+			die("cannot seek");
+		if ((write ? fs_write_ex(fs, fd, buf, chunk) :
+		     fs_read_ex(fs, fd, buf, chunk)) != (int)chunk)
+			die("cannot %s data", write ? "write" : "read");
+	}
+	if (write && fs_sync_ex(fs))
+		die("cannot sync");
+	secs = now() - start;
+
+	report("io", op, chunk, 1, ops, ops * chunk, secs);
+
+	fs_close_ex(fs, fd);
+	vol_umount(fs);
+	free(buf);
+}
+
+static void bench_throughput(void)
+{
+	size_t i;
+	fs_t *fs;
+
+	make_volume(file_size / BLOCK_SIZE + 16);
+	fs = vol_mount();
+	if (fs_create_ex(fs, "data"))
+		die("cannot create data file");
+	vol_umount(fs);
+
+	for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+		/* The first pass also allocates the file */
+		bench_io("seq_write", chunks[i], 1, 0);
+		bench_io("seq_read", chunks[i], 0, 0);
+		bench_io("rand_write", chunks[i], 1, 1);
+		bench_io("rand_read", chunks[i], 0, 1);
+	}
+}
+
+/* Metadata operations as the root directory fills up, then drains */
+static void bench_metadata(void)
+{
+	double t[4] = { 0 };
+	static const char *ops[] = { "create", "open", "stat", "close" };
+	char name[FS_FILENAME_LEN];
+	double start;
+	int i, j, fd;
+	fs_t *fs;
+
+	make_volume(2 * FS_FILE_MAX_COUNT);
+	fs = vol_mount();
+
+	for (i = 0; i < FS_FILE_MAX_COUNT; i++) {
+		snprintf(name, sizeof(name), "file%d", i);
+
+		start = now();
+		if (fs_create_ex(fs, name))
+			die("cannot create %s", name);
+		t[0] += now() - start;
+
+		start = now();
+		fd = open_file(fs, name);
+		t[1] += now() - start;
+
+		start = now();
+		if (fs_stat_ex(fs, fd))
+			die("cannot stat %s", name);
+		t[2] += now() - start;
+
+		start = now();
+		fs_close_ex(fs, fd);
+		t[3] += now() - start;
+
+		/* Latency of the last files created, by directory size */
+		if ((i + 1) % META_BUCKET)
+			continue;
+		for (j = 0; j < 4; j++) {
+			report("meta", ops[j], 0, i + 1, META_BUCKET, 0, t[j]);
+			t[j] = 0;
+		}
+	}
+
+	for (i = FS_FILE_MAX_COUNT - 1; i >= 0; i--) {
+		snprintf(name, sizeof(name), "file%d", i);
+
+		start = now();
+		if (fs_delete_ex(fs, name))
+			die("cannot delete %s", name);
+		t[0] += now() - start;
+
+		if (i % META_BUCKET)
+			continue;
+		report("meta", "delete", 0, i + META_BUCKET, META_BUCKET, 0,
+		       t[0]);
+		t[0] = 0;
+	}
+
+	vol_umount(fs);
+}
+
+static void bench_mount_rounds(int files)
+{
+	double tm = 0, tu = 0, start;
+	fs_t *fs;
+	int i;
+
+	for (i = 0; i < MOUNT_ROUNDS; i++) {
+		start = now();
+		fs = vol_mount();
+		tm += now() - start;
+
+		start = now();
+		vol_umount(fs);
+		tu += now() - start;
+	}
+
+	report("mount", "mount", 0, files, MOUNT_ROUNDS, 0, tm);
+	report("mount", "umount", 0, files, MOUNT_ROUNDS, 0, tu);
+}
+
+/* Mount time on the throughput volume, empty and with a full directory */
+static void bench_mount(void)
+{
+	char name[FS_FILENAME_LEN];
+	fs_t *fs;
+	int i;
+
+	make_volume(file_size / BLOCK_SIZE + FS_FILE_MAX_COUNT);
+	bench_mount_rounds(0);
+
+	fs = vol_mount();
+	for (i = 0; i < FS_FILE_MAX_COUNT; i++) {
+		snprintf(name, sizeof(name), "file%d", i);
+		if (fs_create_ex(fs, name))
+			die("cannot create %s", name);
+	}
+	vol_umount(fs);
+	bench_mount_rounds(FS_FILE_MAX_COUNT);
+}
+
+/*
+ * Create and delete a full root directory of files on the throughput volume,
+ * with single calls then a sync, and with one batch
+ */
+static void bench_batch(void)
+{
+	static struct fs_batch_item items[2 * FS_FILE_MAX_COUNT];
+	char names[FS_FILE_MAX_COUNT][FS_FILENAME_LEN];
+	double tl = 0, tb = 0, start;
+	int i, round;
+	fs_t *fs;
+
+	make_volume(file_size / BLOCK_SIZE + FS_FILE_MAX_COUNT);
+	fs = vol_mount();
+
+	for (i = 0; i < FS_FILE_MAX_COUNT; i++) {
+		snprintf(names[i], sizeof(names[i]), "file%d", i);
+		items[i].op = FS_BATCH_CREATE;
+		items[i].filename = names[i];
+		items[FS_FILE_MAX_COUNT + i].op = FS_BATCH_DELETE;
+		items[FS_FILE_MAX_COUNT + i].filename = names[i];
+	}
+
+	for (round = 0; round < BATCH_ROUNDS; round++) {
+		start = now();
+		for (i = 0; i < FS_FILE_MAX_COUNT; i++)
+			if (fs_create_ex(fs, names[i]))
+				die("cannot create %s", names[i]);
+		for (i = 0; i < FS_FILE_MAX_COUNT; i++)
+			if (fs_delete_ex(fs, names[i]))
+				die("cannot delete %s", names[i]);
+		if (fs_sync_ex(fs))
+			die("cannot sync %s", path);
+		tl += now() - start;
+
+		start = now();
+		if (fs_batch_ex(fs, items, 2 * FS_FILE_MAX_COUNT))
+			die("cannot run batch");
+		tb += now() - start;
+	}
+
+	report("batch", "single", 0, FS_FILE_MAX_COUNT,
+	       BATCH_ROUNDS * 2 * FS_FILE_MAX_COUNT, 0, tl);
+	report("batch", "batch", 0, FS_FILE_MAX_COUNT,
+	       BATCH_ROUNDS * 2 * FS_FILE_MAX_COUNT, 0, tb);
+
+	vol_umount(fs);
+}
+
+/*
+ * Write the file "data" as records of a few hundred bytes, then read it back,
+ * one record per call or @VEC_RECORDS records per call if @vec
+ */
+static void bench_vec_io(const char *op, int write, int vec)
+{
+	static char records[VEC_RECORDS][VEC_RECORD];
+	struct iovec iov[VEC_RECORDS];
+	size_t span = sizeof(records);
+	unsigned long ops = file_size / span, i;
+	double start;
+	fs_t *fs;
+	int fd, j;
+
+	for (j = 0; j < VEC_RECORDS; j++) {
+		memset(records[j], j, VEC_RECORD);
+		iov[j].iov_base = records[j];
+		iov[j].iov_len = VEC_RECORD;
+	}
+
+	fs = vol_mount();
+	fd = open_file(fs, "data");
+	start = now();
+	for (i = 0; i < ops; i++) {
+		if (vec && (write ? fs_writev_ex(fs, fd, iov, VEC_RECORDS) :
+			    fs_readv_ex(fs, fd, iov, VEC_RECORDS)) != (int)span)
+			die("cannot %s records", write ? "write" : "read");
+		for (j = 0; !vec && j < VEC_RECORDS; j++)
+			if ((write ?
+			     fs_write_ex(fs, fd, records[j], VEC_RECORD) :
+			     fs_read_ex(fs, fd, records[j], VEC_RECORD)) !=
+			    VEC_RECORD)
+				die("cannot %s record", write ? "write" : "read");
+	}
+	if (write && fs_sync_ex(fs))
+		die("cannot sync");
+	report("vec", op, VEC_RECORD, 1, ops * VEC_RECORDS, ops * span,
+	       now() - start);
+	fs_close_ex(fs, fd);
+	vol_umount(fs);
+}
+
+static void bench_vectored(void)
+{
+	char *buf;
+	fs_t *fs;
+	int fd;
+
+	if (!(buf = calloc(1, file_size)))
+		die("cannot allocate memory");
+
+	/* The file is written whole first, so that both passes overwrite it */
+	make_volume(file_size / BLOCK_SIZE + 16);
+	fs = vol_mount();
+	if (fs_create_ex(fs, "data"))
+		die("cannot create data file");
+	fd = open_file(fs, "data");
+	if (fs_write_ex(fs, fd, buf, file_size) != (int)file_size)
+		die("cannot write data file");
+	fs_close_ex(fs, fd);
+	vol_umount(fs);
+	free(buf);
+
+	bench_vec_io("write", 1, 0);
+	bench_vec_io("writev", 1, 1);
+	bench_vec_io("read", 0, 0);
+	bench_vec_io("readv", 0, 1);
+}
+
+/* Read the file "big" whole, @chunk bytes at a time */
+static void bench_frag_read(const char *op, size_t chunk, size_t size)
+{
+	unsigned long ops = size / chunk, i;
+	double start;
+	char *buf;
+	fs_t *fs;
+	int fd;
+
+	if (!(buf = malloc(chunk)))
+		die("cannot allocate memory");
+
+	fs = vol_mount();
+	fd = open_file(fs, "big");
+	start = now();
+	for (i = 0; i < ops; i++)
+		if (fs_read_ex(fs, fd, buf, chunk) != (int)chunk)
+			die("cannot read data");
+	report("frag", op, chunk, 1, ops, ops * chunk, now() - start);
+	fs_close_ex(fs, fd);
+	vol_umount(fs);
+	free(buf);
+}
+
+/*
+ * Fill a volume with a padding file and small files, delete every other small
+ * file, and write a file into the holes. It is read before and after being
+ * defragmented into the space of the padding file.
+ */
+static void bench_fragmented(void)
+{
+	size_t hole = FRAG_HOLE_BLOCKS * BLOCK_SIZE;
+	size_t size = FRAG_FILES / 2 * hole;
+	char name[FS_FILENAME_LEN], *buf;
+	struct fs_defrag_stats stats;
+	double start;
+	fs_t *fs;
+	int i, fd;
+
+	if (!(buf = calloc(1, size)))
+		die("cannot allocate memory");
+
+	/* Data block 0 is never used, and the big file needs its first block */
+	make_volume(FRAG_FILES * FRAG_HOLE_BLOCKS + size / BLOCK_SIZE + 2);
+	fs = vol_mount();
+	for (i = -1; i < FRAG_FILES; i++) {
+		if (i < 0)
+			snprintf(name, sizeof(name), "pad");
+		else
+			snprintf(name, sizeof(name), "small%d", i);
+		if (fs_create_ex(fs, name))
+			die("cannot create %s", name);
+		fd = open_file(fs, name);
+		if (fs_write_ex(fs, fd, buf, i < 0 ? size : hole) !=
+		    (int)(i < 0 ? size : hole))
+			die("cannot fill %s", name);
+		fs_close_ex(fs, fd);
+	}
+	for (i = 0; i < FRAG_FILES; i += 2) {
+		snprintf(name, sizeof(name), "small%d", i);
+		if (fs_delete_ex(fs, name))
+			die("cannot delete %s", name);
+	}
+	if (fs_create_ex(fs, "big"))
+		die("cannot create big file");
+	fd = open_file(fs, "big");
+	if (fs_write_ex(fs, fd, buf, size) != (int)size)
+		die("cannot write big file");
+	fs_close_ex(fs, fd);
+	vol_umount(fs);
+
+	for (i = 0; i < (int)(sizeof(chunks) / sizeof(chunks[0])); i++)
+		bench_frag_read("read_fragmented", chunks[i], size);
+
+	/* Make room for the big file to be moved, then move it */
+	fs = vol_mount();
+	if (fs_delete_ex(fs, "pad"))
+		die("cannot delete padding file");
+	start = now();
+	if (fs_defrag_ex(fs, 0, 0, &stats) < 0)
+		die("cannot defragment");
+	report("frag", "defrag", 0, stats.files, stats.blocks ? stats.blocks : 1,
+	       stats.blocks * BLOCK_SIZE, now() - start);
+	vol_umount(fs);
+
+	for (i = 0; i < (int)(sizeof(chunks) / sizeof(chunks[0])); i++)
+		bench_frag_read("read_defragmented", chunks[i], size);
+
+	free(buf);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: bench_fs.x [-f image] [-s size_mib] "
+		"[-c cache_blocks] [-m | -d] [-a] [-j] [-t tests]\n"
+		"tests: any of i (I/O), m (metadata), u (mount), "
+		"b (batch), v (vectored I/O), f (fragmentation)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *tests = "imubvf";
+	size_t size_mib = 32;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:s:c:mdajt:")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 's':
+			size_mib = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			opts.cache_blocks = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			opts.disk_mode = BLOCK_DISK_MMAP;
+			break;
+		case 'd':
+			opts.disk_mode = BLOCK_DISK_DIRECT;
+			break;
+		case 'a':
+			opts.delayed_alloc = 1;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 't':
+			tests = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	file_size = size_mib << 20;
+	if (!file_size || file_size / BLOCK_SIZE + FS_FILE_MAX_COUNT >
+	    MAX_DATA_BLOCKS)
+		usage();
+
+	srand(1);
+	if (strchr(tests, 'i'))
+		bench_throughput();
+	if (strchr(tests, 'm'))
+		bench_metadata();
+	if (strchr(tests, 'u'))
+		bench_mount();
+	if (strchr(tests, 'b'))
+		bench_batch();
+	if (strchr(tests, 'v'))
+		bench_vectored();
+	if (strchr(tests, 'f'))
+		bench_fragmented();
+	if (json)
+		printf("%s]\n", nresults ? "\n" : "[");
+
+	unlink(path);
+
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * Journal benchmark
+ *
+ * Measure the cost of making metadata updates durable, with and without a
+ * metadata journal. Each thread repeatedly appends a small record to its own
+ * log file, replaces a scratch file of its own by a new one, then calls
+ * fs_sync() so that the changes survive a crash. Without a journal, every sync
+ * writes back the FAT blocks and the root directory it changed. With one, it
+ * writes a single transaction, and syncs of concurrent threads are committed
+ * together. Results are printed as CSV on stdout, with the disk requests
+ * issued per sync.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "disk.h"
+#include "fs.h"
+
+#define die(fmt, ...) do { \
+	fprintf(stderr, "bench_journal: "fmt"\n", ##__VA_ARGS__); \
+	exit(1); \
+} while (0)
+
+/* Data blocks of the volume, spread over several FAT blocks */
+#define DATA_BLOCKS 16384
+
+/* Journal blocks, when there is one */
+#define JOURNAL_BLOCKS 256
+
+/* Bytes appended before each sync */
+#define RECORD_SIZE 256
+
+static const int thread_counts[] = { 1, 4, 16 };
+
+static const char *path = "bench_journal.img";
+static int syncs = 500;
+static fs_t *fs;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Write an empty volume of @ndata data blocks to @path */
+static void make_volume(size_t ndata)
+{
+	size_t nfat = (ndata * 2 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	size_t total = 2 + nfat + ndata;
+	uint8_t block[BLOCK_SIZE];
+	uint16_t *fields = (uint16_t *)(block + 8);
+	FILE *f;
+
+	if (!(f = fopen(path, "wb")))
+		die("cannot create %s: %s", path, strerror(errno));
+
+	/* Superblock */
+	memset(block, 0, sizeof(block));
+	memcpy(block, "ECS150FS", 8);
+	fields[0] = total;
+	fields[1] = 1 + nfat;
+	fields[2] = 2 + nfat;
+	fields[3] = ndata;
+	block[16] = nfat;
+	fwrite(block, sizeof(block), 1, f);
+
+	/* FAT, whose first entry is never used, and root directory */
+	memset(block, 0, sizeof(block));
+	block[0] = block[1] = 0xff;
+	fwrite(block, sizeof(block), 1, f);
+	block[0] = block[1] = 0;
+	for (size_t i = 1; i < nfat + 1; i++)
+		fwrite(block, sizeof(block), 1, f);
+
+	/* Data blocks don't need to be written */
+	if (fflush(f) || ftruncate(fileno(f), total * BLOCK_SIZE))
+		die("cannot write %s: %s", path, strerror(errno));
+	fclose(f);
+}
+
+/* Update the files of a thread and sync, @syncs times */
+static void *worker(void *arg)
+{
+	char name[FS_FILENAME_LEN], scratch[FS_FILENAME_LEN];
+	char record[RECORD_SIZE];
+	int fd, i;
+
+	snprintf(name, sizeof(name), "log%ld", (long)arg);
+	snprintf(scratch, sizeof(scratch), "tmp%ld", (long)arg);
+	memset(record, 'a' + (long)arg % 26, sizeof(record));
+	if (fs_create_ex(fs, name) || (fd = fs_open_ex(fs, name)) < 0)
+		die("cannot create %s", name);
+
+	for (i = 0; i < syncs; i++) {
+		if (fs_write_ex(fs, fd, record, sizeof(record)) !=
+		    sizeof(record))
+			die("cannot write %s", name);
+		if ((i && fs_delete_ex(fs, scratch)) ||
+		    fs_create_ex(fs, scratch))
+			die("cannot replace %s", scratch);
+		if (fs_sync_ex(fs))
+			die("cannot sync %s", path);
+	}
+
+	fs_close_ex(fs, fd);
+
+	return NULL;
+}
+
+static void run(int nthreads, int journal)
+{
+	struct fs_options opts = {
+		.cache_blocks = FS_CACHE_BLOCKS,
+		.journal_blocks = journal ? JOURNAL_BLOCKS : 0,
+	};
+	pthread_t threads[16];
+	struct fs_stats before, after;
+	double start, elapsed;
+	size_t total = (size_t)nthreads * syncs;
+	long t;
+
+	make_volume(DATA_BLOCKS);
+	if (!(fs = fs_mount_ex(path, &opts)))
+		die("cannot mount %s", path);
+	if (fs_get_stats_ex(fs, &before))
+		die("cannot get stats");
+
+	start = now();
+	for (t = 0; t < nthreads; t++)
+		if (pthread_create(&threads[t], NULL, worker, (void *)t))
+			die("cannot create thread");
+	for (t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+	elapsed = now() - start;
+
+	if (fs_get_stats_ex(fs, &after))
+		die("cannot get stats");
+	if (fs_umount_ex(fs))
+		die("cannot unmount %s", path);
+
+	printf("%s,%d,%zu,%.3f,%.3f,%.3f\n", journal ? "journal" : "none",
+	       nthreads, total, elapsed * 1e6 / total,
+	       (double)(after.disk_writes - before.disk_writes) / total,
+	       (double)(after.blocks_written - before.blocks_written) / total);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: bench_journal.x [-f image] [-n syncs]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	int opt, journal;
+
+	while ((opt = getopt(argc, argv, "f:n:")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'n':
+			syncs = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (syncs < 1)
+		usage();
+
+	printf("journal,threads,syncs,sync_us,disk_writes_per_sync,"
+	       "blocks_written_per_sync\n");
+	for (i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++)
+		for (journal = 0; journal <= 1; journal++)
+			run(thread_counts[i], journal);
+
+	unlink(path);
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Mount benchmark
+ *
+ * Measure how long mounting takes as volumes grow, for a service mounting a
+ * volume for each request. For each volume size and disk mode, time fs_mount
+ * on a freshly formatted volume, whose free space has to be found by reading
+ * the whole FAT ("cold"), then on the same volume once it was unmounted
+ * cleanly ("hinted"). The first fs_create() after mounting is timed as well,
+ * since it is the first call needing the whole free-space index, and so is
+ * fs_umount(). Results are printed as CSV on stdout.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "disk.h"
+#include "fs.h"
+
+#define die(fmt, ...) do { \
+	fprintf(stderr, "bench_mount: "fmt"\n", ##__VA_ARGS__); \
+	exit(1); \
+} while (0)
+
+static const size_t sizes[] = { 1024, 4096, 16384, 65000 };
+
+static const char *path = "bench_mount.img";
+static int rounds = 20;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Write an empty volume of @ndata data blocks to @path */
+static void make_volume(size_t ndata)
+{
+	size_t nfat = (ndata * 2 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	size_t total = 2 + nfat + ndata;
+	uint8_t block[BLOCK_SIZE];
+	uint16_t *fields = (uint16_t *)(block + 8);
+	FILE *f;
+
+	if (!(f = fopen(path, "wb")))
+		die("cannot create %s: %s", path, strerror(errno));
+
+	/* Superblock */
+	memset(block, 0, sizeof(block));
+	memcpy(block, "ECS150FS", 8);
+	fields[0] = total;
+	fields[1] = 1 + nfat;
+	fields[2] = 2 + nfat;
+	fields[3] = ndata;
+	block[16] = nfat;
+	fwrite(block, sizeof(block), 1, f);
+
+	/* FAT, whose first entry is never used, and root directory */
+	memset(block, 0, sizeof(block));
+	block[0] = block[1] = 0xff;
+	fwrite(block, sizeof(block), 1, f);
+	block[0] = block[1] = 0;
+	for (size_t i = 1; i < nfat + 1; i++)
+		fwrite(block, sizeof(block), 1, f);
+
+	/* Data blocks don't need to be written */
+	if (fflush(f) || ftruncate(fileno(f), total * BLOCK_SIZE))
+		die("cannot write %s: %s", path, strerror(errno));
+	fclose(f);
+}
+
+/*
+ * Mount the volume, create a file and unmount it @rounds times, formatting it
+ * first every time if @cold, and print the average times
+ */
+static void run(size_t ndata, const struct fs_options *opts, int cold)
+{
+	double tm = 0, tc = 0, tu = 0, start;
+	char name[FS_FILENAME_LEN];
+	fs_t *fs;
+	int i;
+
+	make_volume(ndata);
+	for (i = 0; i < rounds; i++) {
+		if (cold)
+			make_volume(ndata);
+
+		start = now();
+		if (!(fs = fs_mount_ex(path, opts)))
+			die("cannot mount %s", path);
+		tm += now() - start;
+
+		snprintf(name, sizeof(name), "file%d", i);
+		start = now();
+		if (fs_create_ex(fs, name))
+			die("cannot create %s", name);
+		tc += now() - start;
+
+		start = now();
+		if (fs_umount_ex(fs))
+			die("cannot unmount %s", path);
+		tu += now() - start;
+	}
+
+	printf("%zu,%s,%s,%d,%.3f,%.3f,%.3f\n", ndata,
+	       opts->disk_mode == BLOCK_DISK_MMAP ? "mmap" : "file",
+	       cold ? "cold" : "hinted", rounds, tm * 1e6 / rounds,
+	       tc * 1e6 / rounds, tu * 1e6 / rounds);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: bench_mount.x [-f image] [-n rounds]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct fs_options opts = { .cache_blocks = FS_CACHE_BLOCKS };
+	size_t i;
+	int opt, mode;
+
+	while ((opt = getopt(argc, argv, "f:n:")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (rounds < 1 || rounds > FS_FILE_MAX_COUNT)
+		usage();
+
+	printf("data_blocks,mode,state,rounds,mount_us,first_create_us,"
+	       "umount_us\n");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (mode = 0; mode <= 1; mode++) {
+			opts.disk_mode = mode ? BLOCK_DISK_MMAP :
+				BLOCK_DISK_FILE;
+			run(sizes[i], &opts, 1);
+			run(sizes[i], &opts, 0);
+		}
+	}
+
+	unlink(path);
+
+	return 0;
+}
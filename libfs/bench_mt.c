@@ -0,0 +1,256 @@
+/*
+ * Multithreaded file system benchmark
+ *
+ * Run 1 to 16 threads against a freshly formatted volume and measure how the
+ * file system API scales. In the "private" workload, each thread reads and
+ * rewrites random blocks of its own file and calls fs_stat() on it; in the
+ * "shared" workload, all threads read random blocks of the same file. Every
+ * block read is checked against what was last written to it. With -d, the
+ * volume is mounted with O_DIRECT, so that the block reads which miss the
+ * cache wait for the disk. Results are printed as CSV on stdout.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "disk.h"
+#include "fs.h"
+
+#define die(fmt, ...) do { \
+	fprintf(stderr, "bench_mt: "fmt"\n", ##__VA_ARGS__); \
+	exit(1); \
+} while (0)
+
+#define BLOCK 4096
+#define MAX_THREADS 16
+#define DATA_BLOCKS 4096
+
+static unsigned long ops;
+static size_t file_blocks;
+static int shared;
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int fd;
+	unsigned int seed;
+	unsigned char *version;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Write an empty ECS150FS volume of @ndata data blocks to @path */
+static void make_volume(const char *path, size_t ndata)
+{
+	size_t nfat = (ndata * 2 + BLOCK - 1) / BLOCK;
+	size_t total = 2 + nfat + ndata, i;
+	uint8_t block[BLOCK];
+	uint16_t *fields = (uint16_t *)(block + 8);
+	FILE *f;
+
+	if (!(f = fopen(path, "wb")))
+		die("cannot create %s: %s", path, strerror(errno));
+
+	/* Superblock */
+	memset(block, 0, sizeof(block));
+	memcpy(block, "ECS150FS", 8);
+	fields[0] = total;
+	fields[1] = 1 + nfat;
+	fields[2] = 2 + nfat;
+	fields[3] = ndata;
+	block[16] = nfat;
+	fwrite(block, sizeof(block), 1, f);
+
+	/* FAT, whose first entry is never used, then the rest */
+	memset(block, 0, sizeof(block));
+	for (i = 1; i < total; i++) {
+		block[0] = block[1] = i == 1 ? 0xff : 0;
+		if (fwrite(block, sizeof(block), 1, f) != 1)
+			die("cannot write %s: %s", path, strerror(errno));
+	}
+
+	fclose(f);
+}
+
+/* Fill @buf with the contents of block @blk of thread @id at @version */
+static void fill(unsigned char *buf, int id, size_t blk, unsigned char version)
+{
+	memset(buf, (id * 31 + blk + version) & 0xff, BLOCK);
+}
+
+static int check(const unsigned char *buf, int id, size_t blk,
+		 unsigned char version)
+{
+	unsigned char c = (id * 31 + blk + version) & 0xff;
+
+	return buf[0] == c && buf[BLOCK / 2] == c && buf[BLOCK - 1] == c;
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	unsigned char buf[BLOCK];
+	int owner = shared ? 0 : w->id;
+	unsigned long i;
+	size_t blk;
+	int op;
+
+	for (i = 0; i < ops; i++) {
+		blk = rand_r(&w->seed) % file_blocks;
+		op = shared ? 0 : rand_r(&w->seed) % 4;
+
+		if (op == 3) {
+			if (fs_stat(w->fd) != (int)(file_blocks * BLOCK))
+				die("wrong size from fs_stat");
+			continue;
+		}
+		if (fs_lseek(w->fd, blk * BLOCK))
+			die("cannot seek");
+		if (op == 2) {
+			fill(buf, owner, blk, ++w->version[blk]);
+			if (fs_write(w->fd, buf, BLOCK) != BLOCK)
+				die("cannot write");
+		} else {
+			if (fs_read(w->fd, buf, BLOCK) != BLOCK)
+				die("cannot read");
+			if (!check(buf, owner, blk, w->version[blk]))
+				die("thread %d read bad data from block %zu",
+				    w->id, blk);
+		}
+	}
+
+	return NULL;
+}
+
+/* Create and fill the file of thread @id, then open it again */
+static int make_file(int id, unsigned char *version)
+{
+	unsigned char buf[BLOCK];
+	char name[FS_FILENAME_LEN];
+	size_t blk;
+	int fd;
+
+	snprintf(name, sizeof(name), "file%d", id);
+	if (fs_create(name) || (fd = fs_open(name)) < 0)
+		die("cannot create %s", name);
+	if (fs_reserve(fd, file_blocks * BLOCK))
+		die("cannot reserve %s", name);
+	for (blk = 0; blk < file_blocks; blk++) {
+		fill(buf, id, blk, version[blk]);
+		if (fs_write(fd, buf, BLOCK) != BLOCK)
+			die("cannot fill %s", name);
+	}
+
+	return fd;
+}
+
+static void run(const char *path, const struct fs_options *opts, int nthreads)
+{
+	struct worker workers[MAX_THREADS];
+	char name[FS_FILENAME_LEN];
+	double start, secs;
+	int i;
+
+	make_volume(path, DATA_BLOCKS);
+	if (fs_mount_opts(path, opts))
+		die("cannot mount %s", path);
+
+	for (i = 0; i < nthreads; i++) {
+		workers[i].id = i;
+		workers[i].seed = i + 1;
+		if (!(workers[i].version = calloc(file_blocks, 1)))
+			die("cannot allocate memory");
+		if (!shared || !i) {
+			workers[i].fd = make_file(i, workers[i].version);
+		} else {
+			snprintf(name, sizeof(name), "file0");
+			if ((workers[i].fd = fs_open(name)) < 0)
+				die("cannot open %s", name);
+		}
+	}
+	if (fs_sync())
+		die("cannot sync");
+
+	start = now();
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&workers[i].thread, NULL, worker_run,
+				   &workers[i]))
+			die("cannot start thread");
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].thread, NULL);
+	secs = now() - start;
+
+	printf("%s,%d,%lu,%.6f,%.0f\n", shared ? "shared" : "private",
+	       nthreads, ops * nthreads, secs, ops * nthreads / secs);
+
+	for (i = 0; i < nthreads; i++) {
+		fs_close(workers[i].fd);
+		free(workers[i].version);
+	}
+	if (fs_umount())
+		die("cannot unmount %s", path);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: bench_mt.x [-f image] [-n ops] [-b file_blocks] "
+		"[-c cache_blocks] [-t max_threads] [-d]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = "bench_mt.img";
+	struct fs_options opts = { .cache_blocks = FS_CACHE_BLOCKS };
+	int max_threads = MAX_THREADS, nthreads, opt;
+
+	ops = 20000;
+	file_blocks = 64;
+	while ((opt = getopt(argc, argv, "f:n:b:c:t:d")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'n':
+			ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			file_blocks = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			opts.cache_blocks = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'd':
+			opts.disk_mode = BLOCK_DISK_DIRECT;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!ops || !file_blocks || max_threads < 1 || max_threads > MAX_THREADS ||
+	    file_blocks * MAX_THREADS > DATA_BLOCKS - 1)
+		usage();
+
+	printf("workload,threads,ops,seconds,ops_per_s\n");
+	for (shared = 0; shared <= 1; shared++)
+		for (nthreads = 1; nthreads <= max_threads; nthreads *= 2)
+			run(path, &opts, nthreads);
+
+	unlink(path);
+
+	return 0;
+}
@@ -0,0 +1,806 @@
+#define _GNU_SOURCE /* for IOV_MAX */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "disk.h"
+
+#define cache_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* Maximum number of write-backs in flight during a flush */
+#define CACHE_QUEUE_DEPTH 32
+
+/* Maximum number of prefetch reads in flight */
+#define CACHE_PREFETCH_DEPTH 32
+
+/* Cached block */
+struct cache_entry {
+	/* Disk block held by this entry */
+	size_t block;
+	/* Whether the entry holds a block, and whether it differs from disk */
+	int valid;
+	int dirty;
+	/* Whether a prefetch read is in flight, and whether the block was
+	 * prefetched and not accessed yet */
+	int pending;
+	int prefetched;
+	/* Whether a synchronous transfer of the block is in progress, during
+	 * which the entry is left alone */
+	int busy;
+	/* Prefetch request */
+	struct block_io io;
+	/* LRU list links (most recently used first) */
+	struct cache_entry *prev;
+	struct cache_entry *next;
+	/* Hash bucket chain */
+	struct cache_entry *hnext;
+	/* Block content */
+	char *data;
+};
+
+/*
+ * Cache instance description
+ *
+ * @lock protects the entries, the lists, the prefetch queue and the counters.
+ * Disk transfers are done without it: the entries being read or written back
+ * are busy meanwhile, and threads needing them wait on @idle. @flush_lock
+ * serializes flushes, which use @queue without @lock.
+ */
+struct cache {
+	pthread_mutex_t lock;
+	pthread_cond_t idle;
+	pthread_mutex_t flush_lock;
+	/* Disk the cached blocks belong to */
+	struct block_disk *disk;
+	/* Entries and their backing storage */
+	size_t nentries;
+	struct cache_entry *entries;
+	char *data;
+	/* Block index to entry hash table (power of two buckets) */
+	size_t nbuckets;
+	struct cache_entry **buckets;
+	/* LRU list sentinel */
+	struct cache_entry lru;
+	/* Asynchronous queue used for flushing, created on first need */
+	struct block_queue *queue;
+	int noqueue;
+	/* Asynchronous queue used for prefetching, created on first need */
+	struct block_queue *prefetch_queue;
+	int noprefetch;
+	size_t prefetching;
+	/* Counters */
+	struct cache_stats stats;
+};
+
+static size_t cache_hash(struct cache *c, size_t block)
+{
+	return (block * 2654435761u) & (c->nbuckets - 1);
+}
+
+static void lru_unlink(struct cache_entry *e)
+{
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+}
+
+static void lru_push_front(struct cache *c, struct cache_entry *e)
+{
+	e->next = c->lru.next;
+	e->prev = &c->lru;
+	c->lru.next->prev = e;
+	c->lru.next = e;
+}
+
+static void lru_push_back(struct cache *c, struct cache_entry *e)
+{
+	e->prev = c->lru.prev;
+	e->next = &c->lru;
+	c->lru.prev->next = e;
+	c->lru.prev = e;
+}
+
+static struct cache_entry *cache_find(struct cache *c, size_t block)
+{
+	struct cache_entry *e;
+
+	for (e = c->buckets[cache_hash(c, block)]; e; e = e->hnext)
+		if (e->block == block)
+			return e;
+
+	return NULL;
+}
+
+static void cache_unhash(struct cache *c, struct cache_entry *e)
+{
+	struct cache_entry **p = &c->buckets[cache_hash(c, e->block)];
+
+	while (*p != e)
+		p = &(*p)->hnext;
+	*p = e->hnext;
+}
+
+/* Account for completed prefetch reads, dropping the entries that failed */
+static void cache_prefetch_done(struct cache *c, int min)
+{
+	struct block_io *done[CACHE_PREFETCH_DEPTH];
+	struct cache_entry *e;
+	int i, n;
+
+	n = block_queue_reap(c->prefetch_queue, done, CACHE_PREFETCH_DEPTH,
+			     min);
+	for (i = 0; i < n; i++) {
+		e = done[i]->data;
+		e->pending = 0;
+		c->prefetching--;
+		if (done[i]->result) {
+			cache_unhash(c, e);
+			e->valid = 0;
+			e->prefetched = 0;
+			lru_unlink(e);
+			lru_push_back(c, e);
+		}
+	}
+}
+
+/* Wait for the prefetch read of @e, return -1 if it failed */
+static int cache_wait(struct cache *c, struct cache_entry *e)
+{
+	while (e->pending)
+		cache_prefetch_done(c, 1);
+
+	return e->valid ? 0 : -1;
+}
+
+/*
+ * Find the entry holding @block once it is not busy. Waiting releases the
+ * lock, and the entry may be recycled meanwhile, so it is looked up again.
+ */
+static struct cache_entry *cache_find_idle(struct cache *c, size_t block)
+{
+	struct cache_entry *e;
+
+	while ((e = cache_find(c, block)) && e->busy)
+		pthread_cond_wait(&c->idle, &c->lock);
+
+	return e;
+}
+
+/* Find the entry holding @block, once its content is available */
+static struct cache_entry *cache_lookup(struct cache *c, size_t block)
+{
+	struct cache_entry *e;
+
+	if (!(e = cache_find_idle(c, block)) || cache_wait(c, e))
+		return NULL;
+
+	if (e->prefetched) {
+		e->prefetched = 0;
+		c->stats.prefetch_hits++;
+	}
+
+	return e;
+}
+
+/* End the transfer of busy entry @e, which is clean if it was @written */
+static void cache_release(struct cache *c, struct cache_entry *e, int written)
+{
+	e->busy = 0;
+	if (written) {
+		e->dirty = 0;
+		c->stats.writebacks++;
+	}
+	pthread_cond_broadcast(&c->idle);
+}
+
+/*
+ * Write back entry @e if needed, which must not be busy. The lock is released
+ * during the write.
+ */
+static int cache_clean(struct cache *c, struct cache_entry *e)
+{
+	int ret;
+
+	if (!e->dirty)
+		return 0;
+
+	e->busy = 1;
+	pthread_mutex_unlock(&c->lock);
+	ret = block_write_ex(c->disk, e->block, e->data);
+	pthread_mutex_lock(&c->lock);
+	cache_release(c, e, !ret);
+
+	return ret;
+}
+
+/*
+ * Get an entry for @block, reading it from disk unless @fill is 0. The entry is
+ * moved at the front of the LRU list. The lock is released during disk
+ * transfers.
+ */
+static struct cache_entry *cache_get(struct cache *c, size_t block, int fill)
+{
+	struct cache_entry *e;
+	int ret;
+
+retry:
+	if ((e = cache_lookup(c, block))) {
+		c->stats.hits++;
+		lru_unlink(e);
+		lru_push_front(c, e);
+		return e;
+	}
+
+	/* Recycle the least recently used entry which is not busy */
+	for (e = c->lru.prev; e != &c->lru && e->busy; e = e->prev)
+		;
+	if (e == &c->lru) {
+		pthread_cond_wait(&c->idle, &c->lock);
+		goto retry;
+	}
+	cache_wait(c, e);
+	if (e->valid && e->dirty) {
+		/* Another thread may bring @block in during the write */
+		if (cache_clean(c, e))
+			return NULL;
+		goto retry;
+	}
+
+	c->stats.misses++;
+	if (e->valid) {
+		cache_unhash(c, e);
+		e->valid = 0;
+		e->prefetched = 0;
+		c->stats.evictions++;
+	}
+
+	e->block = block;
+	e->valid = 1;
+	e->hnext = c->buckets[cache_hash(c, block)];
+	c->buckets[cache_hash(c, block)] = e;
+	lru_unlink(e);
+	lru_push_front(c, e);
+	if (!fill)
+		return e;
+
+	/* Threads needing the block wait for its content */
+	e->busy = 1;
+	pthread_mutex_unlock(&c->lock);
+	ret = block_read_ex(c->disk, block, e->data);
+	pthread_mutex_lock(&c->lock);
+	cache_release(c, e, 0);
+	if (ret) {
+		cache_unhash(c, e);
+		e->valid = 0;
+		lru_unlink(e);
+		lru_push_back(c, e);
+		return NULL;
+	}
+
+	return e;
+}
+
+struct cache *cache_create(struct block_disk *d, size_t nblocks)
+{
+	struct cache *c;
+	size_t i;
+
+	if (!(c = calloc(1, sizeof(*c))))
+		return NULL;
+
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->idle, NULL);
+	pthread_mutex_init(&c->flush_lock, NULL);
+	c->disk = d;
+	c->lru.next = c->lru.prev = &c->lru;
+	c->nentries = nblocks;
+	if (!nblocks)
+		return c;
+
+	for (c->nbuckets = 1; c->nbuckets < nblocks; c->nbuckets <<= 1)
+		;
+
+	c->entries = calloc(nblocks, sizeof(*c->entries));
+	/* Aligned so that blocks can be transferred with O_DIRECT */
+	if (posix_memalign((void **)&c->data, BLOCK_SIZE, nblocks * BLOCK_SIZE))
+		c->data = NULL;
+	c->buckets = calloc(c->nbuckets, sizeof(*c->buckets));
+	if (!c->entries || !c->data || !c->buckets) {
+		cache_error("cannot allocate %zu blocks", nblocks);
+		cache_destroy(c);
+		return NULL;
+	}
+
+	for (i = 0; i < nblocks; i++) {
+		c->entries[i].data = c->data + i * BLOCK_SIZE;
+		lru_push_front(c, &c->entries[i]);
+	}
+
+	return c;
+}
+
+void cache_destroy(struct cache *c)
+{
+	if (!c)
+		return;
+
+	/* Prefetch reads still target the entries' storage */
+	while (c->prefetching)
+		cache_prefetch_done(c, 1);
+	block_queue_destroy(c->prefetch_queue);
+	block_queue_destroy(c->queue);
+	pthread_mutex_destroy(&c->flush_lock);
+	pthread_cond_destroy(&c->idle);
+	pthread_mutex_destroy(&c->lock);
+	free(c->buckets);
+	free(c->data);
+	free(c->entries);
+	free(c);
+}
+
+int cache_read(struct cache *c, size_t block, size_t offset, size_t len,
+	       void *buf)
+{
+	struct cache_entry *e;
+	char *bounce;
+	int ret;
+
+	if (offset > BLOCK_SIZE || len > BLOCK_SIZE - offset) {
+		cache_error("invalid range (%zu+%zu)", offset, len);
+		return -1;
+	}
+
+	/* No cache: read from disk, directly into @buf if possible */
+	if (!c->nentries) {
+		__atomic_add_fetch(&c->stats.misses, 1, __ATOMIC_RELAXED);
+		if (len == BLOCK_SIZE)
+			return block_read_ex(c->disk, block, buf);
+		if (!(bounce = block_buf_get()))
+			return -1;
+		if (!(ret = block_read_ex(c->disk, block, bounce)))
+			memcpy(buf, bounce + offset, len);
+		block_buf_put(bounce);
+		return ret;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	if ((e = cache_get(c, block, 1)))
+		memcpy(buf, e->data + offset, len);
+	pthread_mutex_unlock(&c->lock);
+
+	return e ? 0 : -1;
+}
+
+int cache_write(struct cache *c, size_t block, size_t offset, size_t len,
+		const void *buf)
+{
+	struct cache_entry *e;
+	char *bounce;
+	int ret;
+
+	if (offset > BLOCK_SIZE || len > BLOCK_SIZE - offset) {
+		cache_error("invalid range (%zu+%zu)", offset, len);
+		return -1;
+	}
+
+	/* No cache: write through, with a read-modify-write if partial */
+	if (!c->nentries) {
+		__atomic_add_fetch(&c->stats.misses, 1, __ATOMIC_RELAXED);
+		if (len == BLOCK_SIZE)
+			return block_write_ex(c->disk, block, buf);
+		if (!(bounce = block_buf_get()))
+			return -1;
+		if (!(ret = block_read_ex(c->disk, block, bounce))) {
+			memcpy(bounce + offset, buf, len);
+			ret = block_write_ex(c->disk, block, bounce);
+		}
+		block_buf_put(bounce);
+		return ret;
+	}
+
+	/* Overwriting a whole block doesn't need its previous content */
+	pthread_mutex_lock(&c->lock);
+	if ((e = cache_get(c, block, len != BLOCK_SIZE))) {
+		memcpy(e->data + offset, buf, len);
+		e->dirty = 1;
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	return e ? 0 : -1;
+}
+
+/*
+ * Copy @len bytes between @data and the buffers of @iov, from byte @*off of
+ * buffer @*seg on, and move this position past them. Without @data, only the
+ * position moves.
+ */
+static void iov_copy(const struct iovec *iov, int *seg, size_t *off,
+		     void *data, size_t len, int to_iov)
+{
+	char *base;
+	size_t n;
+
+	while (len) {
+		base = (char *)iov[*seg].iov_base + *off;
+		n = iov[*seg].iov_len - *off;
+		if (n > len)
+			n = len;
+		if (data && to_iov)
+			memcpy(base, data, n);
+		else if (data)
+			memcpy(data, base, n);
+		if (data)
+			data = (char *)data + n;
+		len -= n;
+		*off += n;
+		if (*off == iov[*seg].iov_len) {
+			(*seg)++;
+			*off = 0;
+		}
+	}
+}
+
+/* Check that the buffers of @iov hold exactly @count blocks */
+static int iov_check(const struct iovec *iov, int iovcnt, size_t count)
+{
+	size_t total = 0;
+	int i;
+
+	if (!iov || iovcnt <= 0 || iovcnt > IOV_MAX) {
+		cache_error("invalid iovec count '%d'", iovcnt);
+		return -1;
+	}
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+	if (total != count * BLOCK_SIZE) {
+		cache_error("invalid iovec length '%zu'", total);
+		return -1;
+	}
+
+	return 0;
+}
+
+int cache_readv(struct cache *c, size_t block, size_t count,
+		const struct iovec *iov, int iovcnt)
+{
+	struct cache_entry *e;
+	size_t i, off = 0;
+	int seg = 0;
+
+	if (count == 1 && iovcnt == 1)
+		return cache_read(c, block, 0, BLOCK_SIZE, iov[0].iov_base);
+	if (iov_check(iov, iovcnt, count))
+		return -1;
+
+	if (!c->nentries) {
+		__atomic_add_fetch(&c->stats.misses, count, __ATOMIC_RELAXED);
+		return block_readv_ex(c->disk, block, iov, iovcnt);
+	}
+
+	/* Blocks which were all prefetched don't need a disk request */
+	pthread_mutex_lock(&c->lock);
+	for (i = 0; i < count; i++)
+		if (!cache_find(c, block + i))
+			break;
+	if (i == count) {
+		for (i = 0; i < count; i++) {
+			if (!(e = cache_lookup(c, block + i)))
+				break;
+			iov_copy(iov, &seg, &off, e->data, BLOCK_SIZE, 1);
+			lru_unlink(e);
+			lru_push_front(c, e);
+			c->stats.hits++;
+		}
+		if (i == count) {
+			pthread_mutex_unlock(&c->lock);
+			return 0;
+		}
+	}
+
+	/*
+	 * Otherwise the range is read from disk, once the cached blocks which are
+	 * more recent than their copy on disk are written back. Reading them
+	 * from the cache afterwards instead could miss a block being evicted.
+	 */
+	for (i = 0; i < count; i++) {
+		if ((e = cache_find_idle(c, block + i)) && cache_clean(c, e)) {
+			pthread_mutex_unlock(&c->lock);
+			return -1;
+		}
+	}
+	c->stats.misses += count;
+	pthread_mutex_unlock(&c->lock);
+
+	return block_readv_ex(c->disk, block, iov, iovcnt);
+}
+
+int cache_read_range(struct cache *c, size_t block, size_t count, void *buf)
+{
+	struct iovec iov = { buf, count * BLOCK_SIZE };
+
+	return cache_readv(c, block, count, &iov, 1);
+}
+
+int cache_writev(struct cache *c, size_t block, size_t count,
+		 const struct iovec *iov, int iovcnt)
+{
+	struct cache_entry *e;
+	size_t i, off = 0;
+	int seg = 0;
+
+	if (count == 1 && iovcnt == 1)
+		return cache_write(c, block, 0, BLOCK_SIZE, iov[0].iov_base);
+	if (iov_check(iov, iovcnt, count))
+		return -1;
+
+	/*
+	 * Cached copies are updated first, so that an older dirty copy cannot
+	 * be written back after the new data. They stay dirty until the new
+	 * data is on disk, so that a failed write is retried by the next flush.
+	 */
+	pthread_mutex_lock(&c->lock);
+	for (i = 0; c->nentries && i < count; i++) {
+		if ((e = cache_find_idle(c, block + i)) && !cache_wait(c, e)) {
+			e->prefetched = 0;
+			iov_copy(iov, &seg, &off, e->data, BLOCK_SIZE, 0);
+			e->dirty = 1;
+		} else {
+			iov_copy(iov, &seg, &off, NULL, BLOCK_SIZE, 0);
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	if (block_writev_ex(c->disk, block, iov, iovcnt))
+		return -1;
+
+	/* Copies being written back meanwhile are cleaned once written */
+	pthread_mutex_lock(&c->lock);
+	for (i = 0; c->nentries && i < count; i++)
+		if ((e = cache_find(c, block + i)) && !e->busy)
+			e->dirty = 0;
+	pthread_mutex_unlock(&c->lock);
+
+	return 0;
+}
+
+int cache_write_range(struct cache *c, size_t block, size_t count,
+		      const void *buf)
+{
+	struct iovec iov = { (void *)buf, count * BLOCK_SIZE };
+
+	return cache_writev(c, block, count, &iov, 1);
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+	size_t x = (*(struct cache_entry * const *)a)->block;
+	size_t y = (*(struct cache_entry * const *)b)->block;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Write back the @n busy entries of @dirty through the asynchronous queue,
+ * keeping up to its depth of writes in flight. Each entry is released once its
+ * write is complete, or at the end if it could not be queued.
+ */
+static int cache_writeback(struct cache *c, struct cache_entry **dirty,
+			   size_t n)
+{
+	struct block_io ios[CACHE_QUEUE_DEPTH], *done[CACHE_QUEUE_DEPTH];
+	struct block_io *unused[CACHE_QUEUE_DEPTH];
+	size_t next = 0, queued = 0;
+	int i, count, nunused = CACHE_QUEUE_DEPTH, ret = 0;
+
+	for (i = 0; i < CACHE_QUEUE_DEPTH; i++)
+		unused[i] = &ios[i];
+
+	while (next < n || nunused < CACHE_QUEUE_DEPTH) {
+		/* Fill the queue with requests that are not in flight */
+		for (; next < n && nunused; next++) {
+			struct block_io *io = unused[--nunused];
+
+			io->block = dirty[next]->block;
+			io->count = 1;
+			io->buf = dirty[next]->data;
+			io->write = 1;
+			io->data = dirty[next];
+			if (block_queue_add(c->queue, io)) {
+				unused[nunused++] = io;
+				ret = -1;
+				next = n;
+				break;
+			}
+			queued++;
+		}
+		/* Requests which cannot be sent come back as failed ones */
+		if (block_queue_submit(c->queue) < 0) {
+			ret = -1;
+			next = n;
+		}
+
+		count = block_queue_reap(c->queue, done, CACHE_QUEUE_DEPTH, 1);
+		pthread_mutex_lock(&c->lock);
+		for (i = 0; i < count; i++) {
+			unused[nunused++] = done[i];
+			if (done[i]->result)
+				ret = -1;
+			cache_release(c, done[i]->data, !done[i]->result);
+		}
+		pthread_mutex_unlock(&c->lock);
+	}
+
+	pthread_mutex_lock(&c->lock);
+	for (; queued < n; queued++)
+		cache_release(c, dirty[queued], 0);
+	pthread_mutex_unlock(&c->lock);
+
+	return ret;
+}
+
+int cache_flush(struct cache *c)
+{
+	struct cache_entry **dirty, *e;
+	size_t i, n = 0, nbusy = 0;
+	int ret = 0;
+
+	if (!c->nentries)
+		return 0;
+
+	if (!(dirty = malloc(c->nentries * sizeof(*dirty)))) {
+		cache_error("cannot allocate flush list");
+		return -1;
+	}
+
+	pthread_mutex_lock(&c->flush_lock);
+	pthread_mutex_lock(&c->lock);
+
+	/*
+	 * Dirty entries are written back without the lock, busy so that they
+	 * don't change meanwhile. Those which already are busy are listed from
+	 * the end of @dirty, and checked again once their transfer is over.
+	 */
+	for (i = 0; i < c->nentries; i++) {
+		e = &c->entries[i];
+		if (!e->valid || !e->dirty)
+			continue;
+		if (e->busy) {
+			dirty[c->nentries - ++nbusy] = e;
+			continue;
+		}
+		e->busy = 1;
+		dirty[n++] = e;
+	}
+
+	/* Write back in disk order, several blocks at a time if possible */
+	qsort(dirty, n, sizeof(*dirty), entry_cmp);
+	if (n > 1 && !c->queue && !c->noqueue) {
+		c->queue = block_queue_create_ex(c->disk, CACHE_QUEUE_DEPTH,
+						 BLOCK_QUEUE_AUTO);
+		c->noqueue = !c->queue;
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	if (n > 1 && c->queue) {
+		ret = cache_writeback(c, dirty, n);
+	} else {
+		for (i = 0; i < n; i++) {
+			int err = block_write_ex(c->disk, dirty[i]->block,
+						 dirty[i]->data);
+
+			pthread_mutex_lock(&c->lock);
+			cache_release(c, dirty[i], !err);
+			pthread_mutex_unlock(&c->lock);
+			if (err)
+				ret = -1;
+		}
+	}
+
+	pthread_mutex_lock(&c->lock);
+	for (i = c->nentries - nbusy; i < c->nentries; i++) {
+		e = dirty[i];
+		while (e->busy)
+			pthread_cond_wait(&c->idle, &c->lock);
+		if (e->valid && e->dirty && cache_clean(c, e))
+			ret = -1;
+	}
+	pthread_mutex_unlock(&c->lock);
+	pthread_mutex_unlock(&c->flush_lock);
+
+	free(dirty);
+
+	return ret;
+}
+
+/*
+ * Find the least recently used entry that prefetching can recycle, skipping
+ * the blocks prefetched earlier which were not accessed yet. A dirty entry
+ * would need a synchronous write, so none is returned then.
+ */
+static struct cache_entry *cache_prefetch_victim(struct cache *c)
+{
+	struct cache_entry *e;
+
+	for (e = c->lru.prev; e != &c->lru; e = e->prev) {
+		if (e->pending || e->prefetched || e->busy)
+			continue;
+		return e->valid && e->dirty ? NULL : e;
+	}
+
+	return NULL;
+}
+
+int cache_prefetch(struct cache *c, const size_t *blocks, size_t count)
+{
+	struct cache_entry *e;
+	size_t i;
+	int ret;
+
+	if (!c->nentries || !count)
+		return 0;
+
+	pthread_mutex_lock(&c->lock);
+	if (!c->prefetch_queue && !c->noprefetch) {
+		c->prefetch_queue = block_queue_create_ex(c->disk,
+							  CACHE_PREFETCH_DEPTH,
+							  BLOCK_QUEUE_AUTO);
+		c->noprefetch = !c->prefetch_queue;
+	}
+	if (!c->prefetch_queue) {
+		pthread_mutex_unlock(&c->lock);
+		return -1;
+	}
+
+	/* Free the slots of the reads which are already complete */
+	if (c->prefetching)
+		cache_prefetch_done(c, 0);
+
+	for (i = 0; i < count && c->prefetching < CACHE_PREFETCH_DEPTH; i++) {
+		if (cache_find(c, blocks[i]))
+			continue;
+
+		if (!(e = cache_prefetch_victim(c)))
+			break;
+		if (e->valid) {
+			cache_unhash(c, e);
+			e->valid = 0;
+			e->prefetched = 0;
+			c->stats.evictions++;
+		}
+
+		e->io.block = blocks[i];
+		e->io.count = 1;
+		e->io.buf = e->data;
+		e->io.write = 0;
+		e->io.data = e;
+		if (block_queue_add(c->prefetch_queue, &e->io))
+			break;
+
+		e->block = blocks[i];
+		e->valid = 1;
+		e->pending = 1;
+		e->prefetched = 1;
+		e->hnext = c->buckets[cache_hash(c, e->block)];
+		c->buckets[cache_hash(c, e->block)] = e;
+		lru_unlink(e);
+		lru_push_front(c, e);
+		c->prefetching++;
+		c->stats.prefetches++;
+	}
+
+	ret = block_queue_submit(c->prefetch_queue) < 0 ? -1 : 0;
+	pthread_mutex_unlock(&c->lock);
+
+	return ret;
+}
+
+void cache_get_stats(struct cache *c, struct cache_stats *stats)
+{
+	pthread_mutex_lock(&c->lock);
+	*stats = c->stats;
+	pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,194 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h> /* for size_t definition */
+#include <sys/uio.h> /* for struct iovec definition */
+
+/* Opaque block cache instance */
+struct cache;
+
+/* Virtual disk, from disk.h */
+struct block_disk;
+
+/**
+ * struct cache_stats - Block cache counters
+ * @hits: Number of lookups served from the cache
+ * @misses: Number of lookups that had to read the block from disk
+ * @evictions: Number of valid blocks dropped to make room for another one
+ * @writebacks: Number of dirty blocks written back to disk
+ * @prefetches: Number of blocks read ahead with cache_prefetch()
+ * @prefetch_hits: Number of prefetched blocks which were accessed before being
+ *                 evicted
+ */
+struct cache_stats {
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t writebacks;
+	size_t prefetches;
+	size_t prefetch_hits;
+};
+
+/**
+ * cache_create - Create a block cache
+ * @d: Disk the cache is in front of, which must stay open as long as the cache
+ *     exists
+ * @nblocks: Number of blocks the cache can hold
+ *
+ * Create a write-back cache with LRU replacement in front of virtual disk @d.
+ * A cache of size 0 is valid: every access then goes straight to the disk. A
+ * cache can be used by several threads, provided that they don't access the
+ * same block at the same time. Disk transfers are done without holding the
+ * cache's lock, so that the misses of different threads overlap.
+ *
+ * Return: NULL if memory cannot be allocated. The new cache otherwise.
+ */
+struct cache *cache_create(struct block_disk *d, size_t nblocks);
+
+/**
+ * cache_destroy - Destroy a block cache
+ * @c: Cache to destroy
+ *
+ * Release all the memory held by cache @c. Dirty blocks are discarded, so
+ * cache_flush() should be called first if their content matters.
+ */
+void cache_destroy(struct cache *c);
+
+/**
+ * cache_read - Read part of a block through the cache
+ * @c: Cache
+ * @block: Index of the block to read from
+ * @offset: Offset within the block
+ * @len: Number of bytes to read
+ * @buf: Data buffer to be filled
+ *
+ * Copy @len bytes starting at @offset in block @block into @buf. The block is
+ * read from disk only if it is not already cached.
+ *
+ * Return: -1 if the range does not fit in a block or if the block cannot be
+ * read. 0 otherwise.
+ */
+int cache_read(struct cache *c, size_t block, size_t offset, size_t len,
+	       void *buf);
+
+/**
+ * cache_write - Write part of a block through the cache
+ * @c: Cache
+ * @block: Index of the block to write to
+ * @offset: Offset within the block
+ * @len: Number of bytes to write
+ * @buf: Data buffer to write in the block
+ *
+ * Copy @len bytes from @buf at @offset in block @block. The block is only
+ * marked dirty; it reaches the disk when it gets evicted or when the cache is
+ * flushed. A partial write of an uncached block first reads it from disk.
+ *
+ * Return: -1 if the range does not fit in a block or if the block cannot be
+ * read or written. 0 otherwise.
+ */
+int cache_write(struct cache *c, size_t block, size_t offset, size_t len,
+		const void *buf);
+
+/**
+ * cache_read_range - Read consecutive blocks through the cache
+ * @c: Cache
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Data buffer to be filled (@count * %BLOCK_SIZE bytes)
+ *
+ * A single block is read through the cache like with cache_read(). A longer
+ * range is copied from the cache if all its blocks are cached. Otherwise it is
+ * read from disk as one request, without being added to the cache, after the
+ * dirty cached blocks of the range are written back.
+ *
+ * Return: -1 if the blocks cannot be read. 0 otherwise.
+ */
+int cache_read_range(struct cache *c, size_t block, size_t count, void *buf);
+
+/**
+ * cache_write_range - Write consecutive blocks through the cache
+ * @c: Cache
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Data buffer to write in the blocks (@count * %BLOCK_SIZE bytes)
+ *
+ * A single block is written in the cache like with cache_write(). A longer
+ * range is written to disk as one request, and the cached copies of its blocks
+ * are updated. They become clean once the request succeeds, and stay dirty if
+ * it fails.
+ *
+ * Return: -1 if the blocks cannot be written. 0 otherwise.
+ */
+int cache_write_range(struct cache *c, size_t block, size_t count,
+		      const void *buf);
+
+/**
+ * cache_readv - Read consecutive blocks through the cache into scattered
+ * buffers
+ * @c: Cache
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @iov: Array of buffers to be filled, of @count * %BLOCK_SIZE bytes in total
+ * @iovcnt: Number of buffers in @iov (at most %IOV_MAX)
+ *
+ * Same as cache_read_range(), but the content of the blocks is scattered, in
+ * order, into the buffers of @iov, which can be of any size. A range which is
+ * not cached is read from disk as one request.
+ *
+ * Return: -1 if @iov is invalid or if the blocks cannot be read. 0 otherwise.
+ */
+int cache_readv(struct cache *c, size_t block, size_t count,
+		const struct iovec *iov, int iovcnt);
+
+/**
+ * cache_writev - Write consecutive blocks through the cache from scattered
+ * buffers
+ * @c: Cache
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @iov: Array of buffers to write, of @count * %BLOCK_SIZE bytes in total
+ * @iovcnt: Number of buffers in @iov (at most %IOV_MAX)
+ *
+ * Same as cache_write_range(), but the buffers of @iov, which can be of any
+ * size, are gathered in order and written as one request.
+ *
+ * Return: -1 if @iov is invalid or if the blocks cannot be written. 0
+ * otherwise.
+ */
+int cache_writev(struct cache *c, size_t block, size_t count,
+		 const struct iovec *iov, int iovcnt);
+
+/**
+ * cache_prefetch - Read blocks ahead of their use
+ * @c: Cache
+ * @blocks: Indexes of the blocks to read
+ * @count: Number of blocks in @blocks
+ *
+ * Start asynchronous reads of the blocks of @blocks which are not cached yet,
+ * and return without waiting for them. A later access to one of these blocks
+ * only waits for its own read to complete. Prefetching stops early, without
+ * error, when too many reads are in flight or when the least recently used
+ * block is dirty, since making room would then need a synchronous write.
+ * Prefetched blocks which were not accessed yet are not recycled for other
+ * prefetches. A cache of size 0 doesn't prefetch.
+ *
+ * Return: -1 if the reads cannot be queued. 0 otherwise.
+ */
+int cache_prefetch(struct cache *c, const size_t *blocks, size_t count);
+
+/**
+ * cache_flush - Write back all dirty blocks
+ * @c: Cache
+ *
+ * Return: -1 if one of the dirty blocks cannot be written. 0 otherwise.
+ */
+int cache_flush(struct cache *c);
+
+/**
+ * cache_get_stats - Get cache counters
+ * @c: Cache
+ * @stats: Structure to be filled with the counters of @c
+ */
+void cache_get_stats(struct cache *c, struct cache_stats *stats);
+
+#endif /* _CACHE_H */
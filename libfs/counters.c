@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "counters.h"
+
+/* Number of shards of each counter */
+#define COUNTERS_SHARDS 16
+
+/* Size of a cache line, which shards are aligned on */
+#define CACHE_LINE 64
+
+/*
+ * Set of counters description
+ *
+ * @values holds @stride counters per shard, @stride being @n rounded up to a
+ * whole number of cache lines so that shards never share one.
+ */
+struct counters {
+	size_t n;
+	size_t stride;
+	uint64_t *values;
+};
+
+/* Shard of the calling thread, assigned on its first update */
+static __thread int thread_shard = -1;
+static unsigned next_shard;
+
+struct counters *counters_create(size_t n)
+{
+	struct counters *c;
+	size_t per_line = CACHE_LINE / sizeof(uint64_t);
+
+	if (!(c = malloc(sizeof(*c))))
+		return NULL;
+
+	c->n = n;
+	c->stride = (n + per_line - 1) / per_line * per_line;
+	if (posix_memalign((void **)&c->values, CACHE_LINE,
+			   COUNTERS_SHARDS * c->stride * sizeof(uint64_t))) {
+		free(c);
+		return NULL;
+	}
+	memset(c->values, 0, COUNTERS_SHARDS * c->stride * sizeof(uint64_t));
+
+	return c;
+}
+
+void counters_destroy(struct counters *c)
+{
+	if (!c)
+		return;
+
+	free(c->values);
+	free(c);
+}
+
+void counters_add(struct counters *c, size_t i, uint64_t v)
+{
+	/* Threads are spread over the shards in turn */
+	if (thread_shard < 0)
+		thread_shard = __atomic_fetch_add(&next_shard, 1,
+						  __ATOMIC_RELAXED) %
+			COUNTERS_SHARDS;
+
+	/* Only contended if more threads than shards count at once */
+	__atomic_fetch_add(&c->values[thread_shard * c->stride + i], v,
+			   __ATOMIC_RELAXED);
+}
+
+void counters_read(struct counters *c, uint64_t *sums)
+{
+	size_t i, s;
+
+	for (i = 0; i < c->n; i++) {
+		sums[i] = 0;
+		for (s = 0; s < COUNTERS_SHARDS; s++)
+			sums[i] += __atomic_load_n(&c->values[s * c->stride + i],
+						   __ATOMIC_RELAXED);
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef _COUNTERS_H
+#define _COUNTERS_H
+
+#include <stddef.h> /* for size_t definition */
+#include <stdint.h> /* for uint64_t definition */
+
+/* Opaque set of counters */
+struct counters;
+
+/**
+ * counters_create - Create a set of counters
+ * @n: Number of counters in the set
+ *
+ * Create @n counters, all starting at 0. Each counter is split in shards,
+ * spread over separate cache lines, and a thread only updates its own shard,
+ * so that threads counting the same events don't contend with each other.
+ * Shards are only summed when the counters are read.
+ *
+ * Return: NULL if memory cannot be allocated. The new set otherwise.
+ */
+struct counters *counters_create(size_t n);
+
+/**
+ * counters_destroy - Destroy a set of counters
+ * @c: Set to destroy (may be NULL)
+ */
+void counters_destroy(struct counters *c);
+
+/**
+ * counters_add - Add to a counter
+ * @c: Set of counters
+ * @i: Index of the counter
+ * @v: Value to add
+ *
+ * Can be called by any number of threads at the same time, without locking.
+ */
+void counters_add(struct counters *c, size_t i, uint64_t v);
+
+/**
+ * counters_read - Read all the counters of a set
+ * @c: Set of counters
+ * @sums: Array to be filled with the value of each counter
+ *
+ * The value of each counter is exact, but counters updated while they are
+ * read may be read before or after the update independently of each other.
+ */
+void counters_read(struct counters *c, uint64_t *sums);
+
+#endif /* _COUNTERS_H */
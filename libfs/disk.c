@@ -1,11 +1,26 @@
+#define _GNU_SOURCE /* for IOV_MAX and O_DIRECT */
+
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+/* Pulled in by linux/io_uring.h, but disk blocks have their own size */
+#undef BLOCK_SIZE
+
+#include "counters.h"
 #include "disk.h"
+#include "trace.h"
 
 #define block_error(fmt, ...) \
 	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
@@ -13,132 +28,1267 @@
 /* Invalid file descriptor */
 #define INVALID_FD -1
 
-/* Disk instance description */
-struct disk {
+/*
+ * Disk instance description
+ *
+ * The functions without a disk argument operate on a static instance, the
+ * currently open virtual disk. Instances opened with block_disk_open_ex() are
+ * allocated, and any number of them can be open at the same time.
+ *
+ * Block I/O uses positional reads and writes, so it doesn't depend on a shared
+ * file offset and any number of threads can perform it concurrently. They hold
+ * @lock for reading, which only keeps the disk from being closed under them.
+ *
+ * In %BLOCK_DISK_MMAP mode, the whole disk file is mapped at @map and block
+ * I/O is a plain memory copy. In %BLOCK_DISK_DIRECT mode, transfers bypass the
+ * host's page cache and buffers which are not block-aligned are bounced through
+ * the buffer pool.
+ */
+struct block_disk {
 	/* File descriptor */
 	int fd;
 	/* Block count */
 	size_t bcount;
+	/* Access mode, and mapping of the disk file in %BLOCK_DISK_MMAP mode */
+	enum block_disk_mode mode;
+	char *map;
+	/* Request and block counters, indexed by &enum disk_counter */
+	struct counters *counters;
+	/* Protects the fields above against concurrent open/close */
+	pthread_rwlock_t lock;
+};
+
+enum disk_counter {
+	DISK_READS,
+	DISK_WRITES,
+	DISK_BLOCKS_READ,
+	DISK_BLOCKS_WRITTEN,
+	DISK_COUNTERS,
 };
 
 /* Currently open virtual disk (invalid by default) */
-static struct disk disk = { .fd = INVALID_FD };
+static struct block_disk disk = {
+	.fd = INVALID_FD,
+	.lock = PTHREAD_RWLOCK_INITIALIZER,
+};
 
 int block_disk_open(const char *diskname)
+{
+	return block_disk_open_mode(diskname, BLOCK_DISK_FILE);
+}
+
+/* Open @diskname as disk @d, which must not be open, with its lock held */
+static int disk_open(struct block_disk *d, const char *diskname,
+		     enum block_disk_mode mode)
 {
 	int fd;
 	struct stat st;
+	void *map = NULL;
 
 	if (!diskname) {
 		block_error("invalid file diskname");
 		return -1;
 	}
 
-	if (disk.fd != INVALID_FD) {
-		block_error("disk already open");
+	if (mode != BLOCK_DISK_FILE && mode != BLOCK_DISK_MMAP &&
+	    mode != BLOCK_DISK_DIRECT) {
+		block_error("invalid mode '%d'", mode);
 		return -1;
 	}
 
-	if ((fd = open(diskname, O_RDWR, 0644)) < 0) {
+	if ((fd = open(diskname, O_RDWR |
+		       (mode == BLOCK_DISK_DIRECT ? O_DIRECT : 0), 0644)) < 0) {
 		perror("open");
 		return -1;
 	}
 
 	if (fstat(fd, &st)) {
 		perror("fstat");
-		return -1;
+		goto err_close;
 	}
 
 	/* The disk image's size should be a multiple of the block size */
 	if (st.st_size % BLOCK_SIZE != 0) {
 		block_error("size '%zu' is not multiple of '%d'",
 			    st.st_size, BLOCK_SIZE);
-		return -1;
+		goto err_close;
 	}
 
-	disk.fd = fd;
-	disk.bcount = st.st_size / BLOCK_SIZE;
+	/* Map the whole disk file, so that blocks can be accessed in place */
+	if (mode == BLOCK_DISK_MMAP) {
+		if (!st.st_size) {
+			block_error("cannot map an empty disk");
+			goto err_close;
+		}
+		map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fd, 0);
+		if (map == MAP_FAILED) {
+			perror("mmap");
+			goto err_close;
+		}
+	}
+
+	if (!(d->counters = counters_create(DISK_COUNTERS))) {
+		block_error("cannot allocate counters");
+		goto err_unmap;
+	}
+
+	d->fd = fd;
+	d->bcount = st.st_size / BLOCK_SIZE;
+	d->mode = mode;
+	d->map = map;
 
 	return 0;
+
+err_unmap:
+	if (map)
+		munmap(map, st.st_size);
+err_close:
+	close(fd);
+	return -1;
 }
 
-int block_disk_close(void)
+int block_disk_open_mode(const char *diskname, enum block_disk_mode mode)
+{
+	int ret = -1;
+
+	pthread_rwlock_wrlock(&disk.lock);
+
+	if (disk.fd != INVALID_FD)
+		block_error("disk already open");
+	else
+		ret = disk_open(&disk, diskname, mode);
+
+	pthread_rwlock_unlock(&disk.lock);
+
+	return ret;
+}
+
+struct block_disk *block_disk_open_ex(const char *diskname,
+				      enum block_disk_mode mode)
+{
+	struct block_disk *d;
+
+	if (!(d = malloc(sizeof(*d)))) {
+		block_error("cannot allocate disk");
+		return NULL;
+	}
+
+	d->fd = INVALID_FD;
+	pthread_rwlock_init(&d->lock, NULL);
+	if (disk_open(d, diskname, mode)) {
+		pthread_rwlock_destroy(&d->lock);
+		free(d);
+		return NULL;
+	}
+
+	return d;
+}
+
+/* Close disk @d, with its lock held */
+static int disk_close(struct block_disk *d)
 {
-	if (disk.fd == INVALID_FD) {
+	if (d->fd == INVALID_FD) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	close(disk.fd);
+	if (d->map) {
+		if (msync(d->map, d->bcount * BLOCK_SIZE, MS_SYNC))
+			perror("msync");
+		munmap(d->map, d->bcount * BLOCK_SIZE);
+		d->map = NULL;
+	}
+
+	close(d->fd);
+	counters_destroy(d->counters);
 
-	disk.fd = INVALID_FD;
+	d->fd = INVALID_FD;
 
 	return 0;
 }
 
+int block_disk_close(void)
+{
+	int ret;
+
+	pthread_rwlock_wrlock(&disk.lock);
+	ret = disk_close(&disk);
+	pthread_rwlock_unlock(&disk.lock);
+
+	return ret;
+}
+
+int block_disk_close_ex(struct block_disk *d)
+{
+	int ret;
+
+	if (!d)
+		return -1;
+
+	ret = disk_close(d);
+	pthread_rwlock_destroy(&d->lock);
+	free(d);
+
+	return ret;
+}
+
+int block_disk_count_ex(struct block_disk *d)
+{
+	int count;
+
+	pthread_rwlock_rdlock(&d->lock);
+
+	if (d->fd == INVALID_FD) {
+		block_error("no disk currently open");
+		count = -1;
+	} else {
+		count = d->bcount;
+	}
+
+	pthread_rwlock_unlock(&d->lock);
+
+	return count;
+}
+
 int block_disk_count(void)
 {
-	if (disk.fd == INVALID_FD) {
+	return block_disk_count_ex(&disk);
+}
+
+int block_disk_sync_ex(struct block_disk *d)
+{
+	int ret = 0;
+
+	pthread_rwlock_rdlock(&d->lock);
+
+	if (d->fd == INVALID_FD) {
 		block_error("no disk currently open");
-		return -1;
+		ret = -1;
+	} else if (d->map) {
+		if ((ret = msync(d->map, d->bcount * BLOCK_SIZE, MS_SYNC)))
+			perror("msync");
+	} else if ((ret = fsync(d->fd))) {
+		perror("fsync");
 	}
 
-	return disk.bcount;
+	pthread_rwlock_unlock(&d->lock);
+
+	return ret;
 }
 
-int block_write(size_t block, const void *buf)
+int block_disk_sync(void)
 {
-	if (disk.fd == INVALID_FD) {
+	return block_disk_sync_ex(&disk);
+}
+
+int block_disk_stats_ex(struct block_disk *d, struct block_disk_stats *stats)
+{
+	uint64_t sums[DISK_COUNTERS];
+	int ret = 0;
+
+	if (!stats)
+		return -1;
+
+	pthread_rwlock_rdlock(&d->lock);
+
+	if (d->fd == INVALID_FD) {
 		block_error("no disk currently open");
+		ret = -1;
+	} else {
+		counters_read(d->counters, sums);
+		stats->reads = sums[DISK_READS];
+		stats->writes = sums[DISK_WRITES];
+		stats->blocks_read = sums[DISK_BLOCKS_READ];
+		stats->blocks_written = sums[DISK_BLOCKS_WRITTEN];
+	}
+
+	pthread_rwlock_unlock(&d->lock);
+
+	return ret;
+}
+
+int block_disk_stats(struct block_disk_stats *stats)
+{
+	return block_disk_stats_ex(&disk, stats);
+}
+
+/* Count, and trace, a request for @count blocks issued to disk @d */
+static void disk_count(struct block_disk *d, int write, size_t block,
+		       size_t count)
+{
+	if (write)
+		TRACE(DISK_WRITE, block, count, 0);
+	else
+		TRACE(DISK_READ, block, count, 0);
+
+	counters_add(d->counters, write ? DISK_WRITES : DISK_READS, 1);
+	counters_add(d->counters, write ? DISK_BLOCKS_WRITTEN :
+		     DISK_BLOCKS_READ, count);
+}
+
+void *block_ptr_ex(struct block_disk *d, size_t block)
+{
+	void *ptr = NULL;
+
+	pthread_rwlock_rdlock(&d->lock);
+
+	if (d->map && block < d->bcount)
+		ptr = d->map + block * BLOCK_SIZE;
+
+	pthread_rwlock_unlock(&d->lock);
+
+	return ptr;
+}
+
+void *block_ptr(size_t block)
+{
+	return block_ptr_ex(&disk, block);
+}
+
+/* Copy the content of @iov from or to the mapping of disk @d */
+static int disk_xfer_map(struct block_disk *d, int write, const struct iovec *iov,
+			 int iovcnt, size_t off)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (write)
+			memcpy(d->map + off, iov[i].iov_base, iov[i].iov_len);
+		else
+			memcpy(iov[i].iov_base, d->map + off, iov[i].iov_len);
+		off += iov[i].iov_len;
+	}
+
+	return 0;
+}
+
+/*
+ * Transfer the content of @iov at offset @off of the disk image, retrying on
+ * short transfers and on interruptions by signals. @iov is consumed.
+ */
+static int disk_xfer(int fd, int write, struct iovec *iov, int iovcnt,
+		     off_t off)
+{
+	ssize_t ret;
+
+	while (iovcnt) {
+		if (iovcnt == 1 && write)
+			ret = pwrite(fd, iov->iov_base, iov->iov_len, off);
+		else if (iovcnt == 1)
+			ret = pread(fd, iov->iov_base, iov->iov_len, off);
+		else if (write)
+			ret = pwritev(fd, iov, iovcnt, off);
+		else
+			ret = preadv(fd, iov, iovcnt, off);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (iovcnt == 1)
+				perror(write ? "pwrite" : "pread");
+			else
+				perror(write ? "pwritev" : "preadv");
+			return -1;
+		}
+
+		/* Reading past the end of the image is an error, not EOF */
+		if (ret == 0) {
+			block_error("unexpected end of disk image");
+			return -1;
+		}
+
+		/* Skip what was transferred */
+		off += ret;
+		while (iovcnt && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+/* Pool of free I/O buffers, linked through their first word */
+static struct {
+	pthread_mutex_t lock;
+	void *free;
+	unsigned nfree;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Number of free buffers the pool keeps around at most */
+#define POOL_MAX_FREE 32
+
+void *block_buf_get(void)
+{
+	void *buf;
+
+	pthread_mutex_lock(&pool.lock);
+	if ((buf = pool.free)) {
+		pool.free = *(void **)buf;
+		pool.nfree--;
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	if (!buf && posix_memalign(&buf, BLOCK_SIZE, BLOCK_BUF_SIZE)) {
+		block_error("cannot allocate I/O buffer");
+		return NULL;
+	}
+
+	return buf;
+}
+
+void block_buf_put(void *buf)
+{
+	if (!buf)
+		return;
+
+	pthread_mutex_lock(&pool.lock);
+	if (pool.nfree < POOL_MAX_FREE) {
+		*(void **)buf = pool.free;
+		pool.free = buf;
+		pool.nfree++;
+		buf = NULL;
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	free(buf);
+}
+
+/* Copy @len bytes between @buf and @iov, starting @skip bytes into @iov */
+static void iov_copy(const struct iovec *iov, size_t skip, char *buf,
+		     size_t len, int to_iov)
+{
+	size_t n;
+
+	for (; skip >= iov->iov_len; iov++)
+		skip -= iov->iov_len;
+
+	for (; len; iov++, skip = 0) {
+		n = iov->iov_len - skip;
+		if (n > len)
+			n = len;
+		if (to_iov)
+			memcpy((char *)iov->iov_base + skip, buf, n);
+		else
+			memcpy(buf, (char *)iov->iov_base + skip, n);
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * Transfer @len bytes of @iov through buffers of the pool, for O_DIRECT
+ * transfers of memory which is not suitably aligned
+ */
+static int disk_xfer_bounce(int fd, int write, const struct iovec *iov,
+			    size_t len, off_t off)
+{
+	struct iovec biov;
+	size_t done, n;
+	char *bounce;
+	int ret = 0;
+
+	if (!(bounce = block_buf_get()))
 		return -1;
+
+	for (done = 0; !ret && done < len; done += n) {
+		n = len - done < BLOCK_BUF_SIZE ? len - done : BLOCK_BUF_SIZE;
+		if (write)
+			iov_copy(iov, done, bounce, n, 0);
+		biov.iov_base = bounce;
+		biov.iov_len = n;
+		ret = disk_xfer(fd, write, &biov, 1, off + done);
+		if (!ret && !write)
+			iov_copy(iov, done, bounce, n, 1);
 	}
 
-	if (block >= disk.bcount) {
-		block_error("block index out of bounds (%zu/%zu)",
-			    block, disk.bcount);
+	block_buf_put(bounce);
+
+	return ret;
+}
+
+/* Whether the memory of @iov can be used for O_DIRECT transfers */
+static int iov_aligned(const struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		if ((unsigned long)iov[i].iov_base % BLOCK_SIZE ||
+		    iov[i].iov_len % BLOCK_SIZE)
+			return 0;
+
+	return 1;
+}
+
+/* Perform a transfer of @iov, starting at block @block, on disk @d */
+static int disk_rw(struct block_disk *d, int write, size_t block,
+		   struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	int i, ret = -1;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (len % BLOCK_SIZE) {
+		block_error("transfer size '%zu' is not multiple of '%d'",
+			    len, BLOCK_SIZE);
 		return -1;
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		perror("lseek");
+	pthread_rwlock_rdlock(&d->lock);
+
+	if (d->fd == INVALID_FD) {
+		block_error("no disk currently open");
+		goto out;
+	}
+
+	if (block >= d->bcount || len / BLOCK_SIZE > d->bcount - block) {
+		block_error("block index out of bounds (%zu+%zu/%zu)",
+			    block, len / BLOCK_SIZE, d->bcount);
+		goto out;
+	}
+
+	/* Perform the actual transfer at the block's position */
+	disk_count(d, write, block, len / BLOCK_SIZE);
+	if (d->map)
+		ret = disk_xfer_map(d, write, iov, iovcnt, block * BLOCK_SIZE);
+	else if (d->mode == BLOCK_DISK_DIRECT && !iov_aligned(iov, iovcnt))
+		ret = disk_xfer_bounce(d->fd, write, iov, len,
+				       (off_t)block * BLOCK_SIZE);
+	else
+		ret = disk_xfer(d->fd, write, iov, iovcnt,
+				(off_t)block * BLOCK_SIZE);
+
+out:
+	pthread_rwlock_unlock(&d->lock);
+	return ret;
+}
+
+/* Perform a vectored transfer on disk @d, without altering @iov */
+static int disk_rwv(struct block_disk *d, int write, size_t block,
+		    const struct iovec *iov, int iovcnt)
+{
+	if (!iov || iovcnt <= 0 || iovcnt > IOV_MAX) {
+		block_error("invalid iovec count '%d'", iovcnt);
 		return -1;
 	}
 
-	/* Perform the actual write into the disk image */
-	if (write(disk.fd, buf, BLOCK_SIZE) < 0) {
-		perror("write");
+	struct iovec vec[iovcnt];
+
+	memcpy(vec, iov, sizeof(vec));
+
+	return disk_rw(d, write, block, vec, iovcnt);
+}
+
+int block_write_ex(struct block_disk *d, size_t block, const void *buf)
+{
+	struct iovec iov = { (void *)buf, BLOCK_SIZE };
+
+	return disk_rw(d, 1, block, &iov, 1);
+}
+
+int block_write(size_t block, const void *buf)
+{
+	return block_write_ex(&disk, block, buf);
+}
+
+int block_read_ex(struct block_disk *d, size_t block, void *buf)
+{
+	struct iovec iov = { buf, BLOCK_SIZE };
+
+	return disk_rw(d, 0, block, &iov, 1);
+}
+
+int block_read(size_t block, void *buf)
+{
+	return block_read_ex(&disk, block, buf);
+}
+
+int block_write_range_ex(struct block_disk *d, size_t block, size_t count,
+			 const void *buf)
+{
+	struct iovec iov = { (void *)buf, count * BLOCK_SIZE };
+
+	return disk_rw(d, 1, block, &iov, 1);
+}
+
+int block_write_range(size_t block, size_t count, const void *buf)
+{
+	return block_write_range_ex(&disk, block, count, buf);
+}
+
+int block_read_range_ex(struct block_disk *d, size_t block, size_t count,
+			void *buf)
+{
+	struct iovec iov = { buf, count * BLOCK_SIZE };
+
+	return disk_rw(d, 0, block, &iov, 1);
+}
+
+int block_read_range(size_t block, size_t count, void *buf)
+{
+	return block_read_range_ex(&disk, block, count, buf);
+}
+
+int block_writev_ex(struct block_disk *d, size_t block,
+		    const struct iovec *iov, int iovcnt)
+{
+	return disk_rwv(d, 1, block, iov, iovcnt);
+}
+
+int block_writev(size_t block, const struct iovec *iov, int iovcnt)
+{
+	return block_writev_ex(&disk, block, iov, iovcnt);
+}
+
+int block_readv_ex(struct block_disk *d, size_t block,
+		   const struct iovec *iov, int iovcnt)
+{
+	return disk_rwv(d, 0, block, iov, iovcnt);
+}
+
+int block_readv(size_t block, const struct iovec *iov, int iovcnt)
+{
+	return block_readv_ex(&disk, block, iov, iovcnt);
+}
+
+/*
+ * Asynchronous block I/O
+ *
+ * Requests are queued by block_queue_add(), handed to the backend in one batch
+ * by block_queue_submit() and returned by block_queue_reap(). Each request
+ * occupies a slot of the queue from the moment it is added until it is reaped.
+ *
+ * The io_uring backend puts the requests in the submission ring and enters the
+ * kernel once per batch. The thread pool backend hands them to worker threads
+ * performing regular positional I/O.
+ */
+
+/* Request slot */
+struct block_slot {
+	/* Caller's request */
+	struct block_io *io;
+	/* Remaining part of the transfer */
+	struct iovec iov;
+	off_t off;
+	/* Aligned copy of the caller's buffer, for O_DIRECT transfers */
+	void *bounce;
+	/* Link in the free, queued, work or done list */
+	struct block_slot *next;
+};
+
+/* Singly-linked FIFO list of slots */
+struct slot_list {
+	struct block_slot *head;
+	struct block_slot **tail;
+};
+
+/* Asynchronous queue instance description */
+struct block_queue {
+	enum block_queue_backend backend;
+	/* Disk the requests go to */
+	struct block_disk *disk;
+	/* Slots, unused ones, and queued but not yet submitted ones */
+	unsigned depth;
+	struct block_slot *slots;
+	struct block_slot *free;
+	struct slot_list queued;
+	/* Number of submitted requests not reaped yet */
+	unsigned inflight;
+	/* Completed requests not reaped yet */
+	struct slot_list done;
+	unsigned ndone;
+
+	/* io_uring backend */
+	int ring_fd;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Thread pool backend */
+	pthread_t *threads;
+	unsigned nthreads;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct slot_list work;
+	int stop;
+};
+
+static void slot_list_init(struct slot_list *l)
+{
+	l->head = NULL;
+	l->tail = &l->head;
+}
+
+static void slot_list_push(struct slot_list *l, struct block_slot *s)
+{
+	s->next = NULL;
+	*l->tail = s;
+	l->tail = &s->next;
+}
+
+static struct block_slot *slot_list_pop(struct slot_list *l)
+{
+	struct block_slot *s = l->head;
+
+	if (s && !(l->head = s->next))
+		l->tail = &l->head;
+
+	return s;
+}
+
+/* Get an aligned buffer of @len bytes to bounce a transfer through */
+static void *bounce_get(size_t len)
+{
+	void *buf;
+
+	if (len <= BLOCK_BUF_SIZE)
+		return block_buf_get();
+	if (posix_memalign(&buf, BLOCK_SIZE, len)) {
+		block_error("cannot allocate I/O buffer");
+		return NULL;
+	}
+
+	return buf;
+}
+
+static void bounce_put(void *buf, size_t len)
+{
+	if (len <= BLOCK_BUF_SIZE)
+		block_buf_put(buf);
+	else
+		free(buf);
+}
+
+/*
+ * Complete the request of slot @s with @result and move it to the done list,
+ * copying the data read through a bounce buffer to the caller's buffer
+ */
+static void slot_complete(struct block_queue *q, struct block_slot *s,
+			  int result)
+{
+	struct block_io *io = s->io;
+
+	if (s->bounce) {
+		if (!result && !io->write)
+			memcpy(io->buf, s->bounce, io->count * BLOCK_SIZE);
+		bounce_put(s->bounce, io->count * BLOCK_SIZE);
+		s->bounce = NULL;
+	}
+	io->result = result;
+	slot_list_push(&q->done, s);
+	q->ndone++;
+}
+
+/* Account for @ret bytes transferred, return 1 if the transfer is complete */
+static int slot_advance(struct block_slot *s, size_t ret)
+{
+	s->iov.iov_base = (char *)s->iov.iov_base + ret;
+	s->iov.iov_len -= ret;
+	s->off += ret;
+
+	return !s->iov.iov_len;
+}
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+		       unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		       NULL, 0);
+}
+
+static void uring_destroy(struct block_queue *q)
+{
+	if (q->sqes && q->sqes != MAP_FAILED)
+		munmap(q->sqes, q->sqes_size);
+	if (q->cq_ring && q->cq_ring != MAP_FAILED && q->cq_ring != q->sq_ring)
+		munmap(q->cq_ring, q->cq_ring_size);
+	if (q->sq_ring && q->sq_ring != MAP_FAILED)
+		munmap(q->sq_ring, q->sq_ring_size);
+	if (q->ring_fd >= 0)
+		close(q->ring_fd);
+}
+
+static int uring_init(struct block_queue *q)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	if ((q->ring_fd = uring_setup(q->depth, &p)) < 0)
 		return -1;
+
+	q->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	q->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (q->cq_ring_size > q->sq_ring_size)
+			q->sq_ring_size = q->cq_ring_size;
+		q->cq_ring_size = q->sq_ring_size;
 	}
 
+	q->sq_ring = mmap(NULL, q->sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, q->ring_fd,
+			  IORING_OFF_SQ_RING);
+	if (q->sq_ring == MAP_FAILED)
+		return -1;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		q->cq_ring = q->sq_ring;
+	else
+		q->cq_ring = mmap(NULL, q->cq_ring_size,
+				  PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, q->ring_fd,
+				  IORING_OFF_CQ_RING);
+	if (q->cq_ring == MAP_FAILED)
+		return -1;
+
+	q->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	q->sqes = mmap(NULL, q->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, q->ring_fd, IORING_OFF_SQES);
+	if (q->sqes == MAP_FAILED)
+		return -1;
+
+	sq = q->sq_ring;
+	q->sq_head = (unsigned *)(sq + p.sq_off.head);
+	q->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	q->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	q->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+	cq = q->cq_ring;
+	q->cq_head = (unsigned *)(cq + p.cq_off.head);
+	q->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	q->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	q->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
 	return 0;
 }
 
-int block_read(size_t block, void *buf)
+/* Put slot @s in the submission ring. The disk lock must be held. */
+static void uring_prep(struct block_queue *q, struct block_slot *s)
 {
-	if (disk.fd == INVALID_FD) {
+	unsigned tail = *q->sq_tail;
+	unsigned index = tail & *q->sq_mask;
+	struct io_uring_sqe *sqe = &q->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = s->io->write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = q->disk->fd;
+	sqe->addr = (unsigned long)&s->iov;
+	sqe->len = 1;
+	sqe->off = s->off;
+	sqe->user_data = (unsigned long)s;
+
+	q->sq_array[index] = index;
+	__atomic_store_n(q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Hand the last @count entries of the submission ring to the kernel. Those it
+ * doesn't take are removed from the ring, and their requests fail at once.
+ */
+static int uring_submit(struct block_queue *q, unsigned count)
+{
+	unsigned tail, i;
+	int ret;
+
+	while (count) {
+		ret = uring_enter(q->ring_fd, count, 0, 0);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			perror("io_uring_enter");
+			break;
+		}
+		count -= ret;
+	}
+	if (!count)
+		return 0;
+
+	tail = *q->sq_tail;
+	for (i = tail - count; i != tail; i++)
+		slot_complete(q, (struct block_slot *)(unsigned long)
+			      q->sqes[q->sq_array[i & *q->sq_mask]].user_data,
+			      -1);
+	__atomic_store_n(q->sq_tail, tail - count, __ATOMIC_RELEASE);
+
+	return -1;
+}
+
+/*
+ * Submit the slots of @list, which fail at once if the disk was closed. The
+ * disk lock must be held.
+ */
+static int uring_send(struct block_queue *q, struct slot_list *list)
+{
+	struct block_slot *s;
+	unsigned count = 0;
+
+	if (q->disk->fd == INVALID_FD) {
 		block_error("no disk currently open");
+		while ((s = slot_list_pop(list)))
+			slot_complete(q, s, -1);
 		return -1;
 	}
 
-	if (block >= disk.bcount) {
-		block_error("block index out of bounds (%zu/%zu)",
-			    block, disk.bcount);
+	while ((s = slot_list_pop(list))) {
+		uring_prep(q, s);
+		count++;
+	}
+
+	return uring_submit(q, count);
+}
+
+/*
+ * Move the completions available in the completion ring to the done list,
+ * resubmitting the requests that were only partially performed
+ */
+static int uring_complete(struct block_queue *q)
+{
+	unsigned head = *q->cq_head;
+	unsigned tail = __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE);
+	struct slot_list resubmit;
+	struct io_uring_cqe *cqe;
+	struct block_slot *s;
+	int ret;
+
+	slot_list_init(&resubmit);
+	for (; head != tail; head++) {
+		cqe = &q->cqes[head & *q->cq_mask];
+		s = (struct block_slot *)(unsigned long)cqe->user_data;
+
+		if (cqe->res == -EINTR || cqe->res == -EAGAIN ||
+		    (cqe->res > 0 && !slot_advance(s, cqe->res))) {
+			slot_list_push(&resubmit, s);
+			continue;
+		}
+
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			perror(s->io->write ? "IORING_OP_WRITEV" :
+			       "IORING_OP_READV");
+		} else if (cqe->res == 0) {
+			block_error("unexpected end of disk image");
+		}
+		slot_complete(q, s, cqe->res > 0 ? 0 : -1);
+	}
+
+	__atomic_store_n(q->cq_head, head, __ATOMIC_RELEASE);
+
+	if (!resubmit.head)
+		return 0;
+
+	pthread_rwlock_rdlock(&q->disk->lock);
+	ret = uring_send(q, &resubmit);
+	pthread_rwlock_unlock(&q->disk->lock);
+
+	return ret;
+}
+
+static void *queue_worker(void *arg)
+{
+	struct block_queue *q = arg;
+	struct block_slot *s;
+
+	pthread_mutex_lock(&q->mutex);
+	for (;;) {
+		while (!q->work.head && !q->stop)
+			pthread_cond_wait(&q->work_cond, &q->mutex);
+		if (!(s = slot_list_pop(&q->work)))
+			break;
+		pthread_mutex_unlock(&q->mutex);
+
+		s->io->result = disk_rw(q->disk, s->io->write,
+					s->off / BLOCK_SIZE, &s->iov, 1);
+
+		pthread_mutex_lock(&q->mutex);
+		slot_list_push(&q->done, s);
+		q->ndone++;
+		pthread_cond_signal(&q->done_cond);
+	}
+	pthread_mutex_unlock(&q->mutex);
+
+	return NULL;
+}
+
+static int pool_init(struct block_queue *q)
+{
+	unsigned i;
+
+	/* A worker per request in flight, within reason */
+	q->nthreads = q->depth < 16 ? q->depth : 16;
+	if (!(q->threads = calloc(q->nthreads, sizeof(*q->threads))))
 		return -1;
+
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->work_cond, NULL);
+	pthread_cond_init(&q->done_cond, NULL);
+	slot_list_init(&q->work);
+
+	for (i = 0; i < q->nthreads; i++) {
+		if (pthread_create(&q->threads[i], NULL, queue_worker, q)) {
+			q->nthreads = i;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void pool_destroy(struct block_queue *q)
+{
+	unsigned i;
+
+	if (!q->threads)
+		return;
+
+	pthread_mutex_lock(&q->mutex);
+	q->stop = 1;
+	pthread_cond_broadcast(&q->work_cond);
+	pthread_mutex_unlock(&q->mutex);
+
+	for (i = 0; i < q->nthreads; i++)
+		pthread_join(q->threads[i], NULL);
+
+	pthread_cond_destroy(&q->done_cond);
+	pthread_cond_destroy(&q->work_cond);
+	pthread_mutex_destroy(&q->mutex);
+	free(q->threads);
+}
+
+struct block_queue *block_queue_create_ex(struct block_disk *d, unsigned depth,
+					  enum block_queue_backend backend)
+{
+	struct block_queue *q;
+	unsigned i;
+	int fd;
+
+	if (!depth || depth > BLOCK_QUEUE_MAX_DEPTH) {
+		block_error("invalid queue depth '%u'", depth);
+		return NULL;
+	}
+
+	pthread_rwlock_rdlock(&d->lock);
+	fd = d->fd;
+	pthread_rwlock_unlock(&d->lock);
+	if (fd == INVALID_FD) {
+		block_error("no disk currently open");
+		return NULL;
+	}
+
+	if (!(q = calloc(1, sizeof(*q))))
+		return NULL;
+	if (!(q->slots = calloc(depth, sizeof(*q->slots)))) {
+		free(q);
+		return NULL;
+	}
+
+	q->disk = d;
+	q->depth = depth;
+	q->ring_fd = -1;
+	slot_list_init(&q->queued);
+	slot_list_init(&q->done);
+	for (i = 0; i < depth; i++) {
+		q->slots[i].next = q->free;
+		q->free = &q->slots[i];
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		perror("lseek");
+	/* Prefer io_uring, unless the kernel doesn't have it */
+	if (backend != BLOCK_QUEUE_THREADS) {
+		if (!uring_init(q)) {
+			q->backend = BLOCK_QUEUE_URING;
+			return q;
+		}
+		uring_destroy(q);
+		q->ring_fd = -1;
+		q->sq_ring = q->cq_ring = NULL;
+		q->sqes = NULL;
+		if (backend == BLOCK_QUEUE_URING) {
+			perror("io_uring_setup");
+			goto err;
+		}
+	}
+
+	q->backend = BLOCK_QUEUE_THREADS;
+	if (!pool_init(q))
+		return q;
+	block_error("cannot start worker threads");
+
+err:
+	block_queue_destroy(q);
+	return NULL;
+}
+
+struct block_queue *block_queue_create(unsigned depth,
+				       enum block_queue_backend backend)
+{
+	return block_queue_create_ex(&disk, depth, backend);
+}
+
+void block_queue_destroy(struct block_queue *q)
+{
+	struct block_slot *s;
+	struct block_io *io;
+
+	if (!q)
+		return;
+
+	/* Wait for the requests in flight, which still use their buffers */
+	while (q->inflight && block_queue_reap(q, &io, 1, 1) > 0)
+		;
+	while ((s = slot_list_pop(&q->queued)))
+		if (s->bounce)
+			bounce_put(s->bounce, s->io->count * BLOCK_SIZE);
+
+	if (q->backend == BLOCK_QUEUE_URING)
+		uring_destroy(q);
+	else
+		pool_destroy(q);
+
+	free(q->slots);
+	free(q);
+}
+
+enum block_queue_backend block_queue_backend(struct block_queue *q)
+{
+	return q->backend;
+}
+
+int block_queue_add(struct block_queue *q, struct block_io *io)
+{
+	enum block_disk_mode mode;
+	struct block_slot *s;
+	size_t bcount;
+	void *bounce = NULL;
+
+	pthread_rwlock_rdlock(&q->disk->lock);
+	bcount = q->disk->bcount;
+	mode = q->disk->mode;
+	pthread_rwlock_unlock(&q->disk->lock);
+
+	if (!io || !io->count || io->block >= bcount ||
+	    io->count > bcount - io->block) {
+		block_error("invalid request");
 		return -1;
 	}
 
-	/* Perform the actual read from the disk image */
-	if (read(disk.fd, buf, BLOCK_SIZE) < 0) {
-		perror("read");
+	if (!q->free) {
+		block_error("queue full");
 		return -1;
 	}
 
+	/*
+	 * The kernel rejects O_DIRECT transfers of unaligned memory, which the
+	 * worker threads bounce themselves
+	 */
+	if (q->backend == BLOCK_QUEUE_URING && mode == BLOCK_DISK_DIRECT &&
+	    (unsigned long)io->buf % BLOCK_SIZE) {
+		if (!(bounce = bounce_get(io->count * BLOCK_SIZE)))
+			return -1;
+		if (io->write)
+			memcpy(bounce, io->buf, io->count * BLOCK_SIZE);
+	}
+
+	s = q->free;
+	q->free = s->next;
+
+	s->io = io;
+	s->bounce = bounce;
+	s->iov.iov_base = bounce ? bounce : io->buf;
+	s->iov.iov_len = io->count * BLOCK_SIZE;
+	s->off = (off_t)io->block * BLOCK_SIZE;
+	slot_list_push(&q->queued, s);
+
 	return 0;
 }
 
+int block_queue_submit(struct block_queue *q)
+{
+	struct block_slot *s;
+	unsigned count = 0;
+	int ret = 0;
+
+	if (q->backend == BLOCK_QUEUE_URING) {
+		/* Requests that cannot be submitted complete with an error */
+		pthread_rwlock_rdlock(&q->disk->lock);
+		for (s = q->queued.head; s; s = s->next, count++)
+			disk_count(q->disk, s->io->write, s->io->block,
+				   s->io->count);
+		ret = uring_send(q, &q->queued);
+		pthread_rwlock_unlock(&q->disk->lock);
+	} else {
+		pthread_mutex_lock(&q->mutex);
+		while ((s = slot_list_pop(&q->queued))) {
+			slot_list_push(&q->work, s);
+			count++;
+		}
+		pthread_cond_broadcast(&q->work_cond);
+		pthread_mutex_unlock(&q->mutex);
+	}
+
+	q->inflight += count;
+
+	return ret ? -1 : (int)count;
+}
+
+int block_queue_reap(struct block_queue *q, struct block_io **done, int max,
+		     int min)
+{
+	struct block_slot *s;
+	int n = 0;
+
+	if (min > max)
+		min = max;
+	if ((unsigned)min > q->inflight)
+		min = q->inflight;
+
+	if (q->backend == BLOCK_QUEUE_URING) {
+		/* Wait in the kernel until enough completions are available */
+		while (!uring_complete(q) && q->ndone < (unsigned)min) {
+			if (uring_enter(q->ring_fd, 0, min - q->ndone,
+					IORING_ENTER_GETEVENTS) < 0 &&
+			    errno != EINTR) {
+				perror("io_uring_enter");
+				break;
+			}
+		}
+	} else {
+		pthread_mutex_lock(&q->mutex);
+		while (q->ndone < (unsigned)min)
+			pthread_cond_wait(&q->done_cond, &q->mutex);
+	}
+
+	/* Hand back up to @max requests, the others wait for the next call */
+	while (n < max && (s = slot_list_pop(&q->done))) {
+		done[n++] = s->io;
+		q->ndone--;
+		s->next = q->free;
+		q->free = s;
+	}
+
+	if (q->backend == BLOCK_QUEUE_THREADS)
+		pthread_mutex_unlock(&q->mutex);
+
+	q->inflight -= n;
+
+	return n;
+}
@@ -2,10 +2,42 @@
 #define _DISK_H
 
 #include <stddef.h> /* for size_t definition */
+#include <sys/uio.h> /* for struct iovec definition */
 
 /** Size of a disk block in bytes */
 #define BLOCK_SIZE 4096
 
+/*
+ * Block reads and writes are positional and can be issued concurrently by
+ * several threads against the open virtual disk. Opening and closing the disk
+ * are serialized against them.
+ */
+
+/**
+ * enum block_disk_mode - Virtual disk access modes
+ * @BLOCK_DISK_FILE: Blocks are transferred with positional read and write
+ *                   system calls
+ * @BLOCK_DISK_MMAP: The whole virtual disk file is mapped in memory, blocks are
+ *                   transferred with memory copies and can be accessed in place
+ *                   with block_ptr()
+ * @BLOCK_DISK_DIRECT: The virtual disk file is opened with O_DIRECT, so that
+ *                     blocks are transferred without going through the host's
+ *                     page cache. Buffers which are not aligned on
+ *                     %BLOCK_SIZE are transparently bounced, which buffers from
+ *                     block_buf_get() avoid.
+ */
+enum block_disk_mode {
+	BLOCK_DISK_FILE,
+	BLOCK_DISK_MMAP,
+	BLOCK_DISK_DIRECT,
+};
+
+/** Number of blocks held by a buffer of the I/O buffer pool */
+#define BLOCK_BUF_BLOCKS 32
+
+/** Size in bytes of a buffer of the I/O buffer pool */
+#define BLOCK_BUF_SIZE (BLOCK_BUF_BLOCKS * BLOCK_SIZE)
+
 /**
  * block_disk_open - Open virtual disk file
  * @diskname: Name of the virtual disk file
@@ -19,6 +51,18 @@
  */
 int block_disk_open(const char *diskname);
 
+/**
+ * block_disk_open_mode - Open virtual disk file with a given access mode
+ * @diskname: Name of the virtual disk file
+ * @mode: Access mode
+ *
+ * Same as block_disk_open(), but blocks are accessed according to @mode.
+ *
+ * Return: -1 if @diskname or @mode is invalid, if the virtual disk file cannot
+ * be opened (or mapped) or is already open. 0 otherwise.
+ */
+int block_disk_open_mode(const char *diskname, enum block_disk_mode mode);
+
 /**
  * block_disk_close - Close virtual disk file
  *
@@ -34,6 +78,59 @@ int block_disk_close(void);
  */
 int block_disk_count(void);
 
+/**
+ * block_disk_sync - Flush virtual disk file
+ *
+ * Make sure that all the blocks written so far have reached the storage
+ * holding the virtual disk file (msync() in %BLOCK_DISK_MMAP mode, fsync()
+ * otherwise).
+ *
+ * Return: -1 if there was no virtual disk file opened, or if flushing failed.
+ * 0 otherwise.
+ */
+int block_disk_sync(void);
+
+/**
+ * struct block_disk_stats - Virtual disk counters
+ * @reads: Number of read requests issued to the disk
+ * @writes: Number of write requests issued to the disk
+ * @blocks_read: Number of blocks read by these requests
+ * @blocks_written: Number of blocks written by these requests
+ *
+ * Requests are counted whether they are synchronous or queued, since the disk
+ * was opened. Counting is cheap enough to be always on.
+ */
+struct block_disk_stats {
+	size_t reads;
+	size_t writes;
+	size_t blocks_read;
+	size_t blocks_written;
+};
+
+/**
+ * block_disk_stats - Get disk counters
+ * @stats: Structure to be filled with the counters
+ *
+ * Return: -1 if there was no virtual disk file opened or if @stats is NULL. 0
+ * otherwise.
+ */
+int block_disk_stats(struct block_disk_stats *stats);
+
+/**
+ * block_ptr - Get direct access to a block
+ * @block: Index of the block
+ *
+ * In %BLOCK_DISK_MMAP mode, get a pointer to the content of block @block in
+ * the mapping of the virtual disk file. Blocks are contiguous in the mapping,
+ * so the pointer can be used to access the following blocks too. Writes made
+ * through the pointer update the disk directly. The pointer is valid until the
+ * virtual disk is closed.
+ *
+ * Return: NULL if the virtual disk is not open in %BLOCK_DISK_MMAP mode or if
+ * @block is out of bounds. A pointer to the block otherwise.
+ */
+void *block_ptr(size_t block);
+
 /**
  * block_write - Write a block to disk
  * @block: Index of the block to write to
@@ -43,7 +140,8 @@ int block_disk_count(void);
  * block @block.
  *
  * Return: -1 if @block is out of bounds or inaccessible or if the writing
- * operation fails. 0 otherwise.
+ * operation fails (short writes and interrupted writes are retried). 0
+ * otherwise.
  */
 int block_write(size_t block, const void *buf);
 
@@ -56,9 +154,329 @@ int block_write(size_t block, const void *buf);
  * buffer @buf.
  *
  * Return: -1 if @block is out of bounds or inaccessible, or if the reading
- * operation fails. 0 otherwise.
+ * operation fails (short reads and interrupted reads are retried, and reaching
+ * the end of the disk image is a failure). 0 otherwise.
  */
 int block_read(size_t block, void *buf);
 
+/**
+ * block_write_range - Write consecutive blocks to disk
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Data buffer to write in the blocks
+ *
+ * Write the content of buffer @buf (@count * %BLOCK_SIZE bytes) in the virtual
+ * disk's blocks @block to @block + @count - 1, as a single request.
+ *
+ * Return: -1 if one of the blocks is out of bounds or inaccessible, or if the
+ * writing operation fails. 0 otherwise.
+ */
+int block_write_range(size_t block, size_t count, const void *buf);
+
+/**
+ * block_read_range - Read consecutive blocks from disk
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Data buffer to be filled with content of blocks
+ *
+ * Read the content of virtual disk's blocks @block to @block + @count - 1
+ * (@count * %BLOCK_SIZE bytes) into buffer @buf, as a single request.
+ *
+ * Return: -1 if one of the blocks is out of bounds or inaccessible, or if the
+ * reading operation fails. 0 otherwise.
+ */
+int block_read_range(size_t block, size_t count, void *buf);
+
+/**
+ * block_writev - Write consecutive blocks to disk from scattered buffers
+ * @block: Index of the first block to write to
+ * @iov: Array of buffers to write in the blocks
+ * @iovcnt: Number of buffers in @iov (at most %IOV_MAX)
+ *
+ * Gather the buffers of @iov, in order, and write them in consecutive blocks
+ * starting at @block, as a single request. The total size of the buffers must
+ * be a multiple of %BLOCK_SIZE, but individual buffers can be of any size.
+ *
+ * Return: -1 if @iov is invalid, if one of the blocks is out of bounds or
+ * inaccessible, or if the writing operation fails. 0 otherwise.
+ */
+int block_writev(size_t block, const struct iovec *iov, int iovcnt);
+
+/**
+ * block_readv - Read consecutive blocks from disk into scattered buffers
+ * @block: Index of the first block to read from
+ * @iov: Array of buffers to be filled with content of blocks
+ * @iovcnt: Number of buffers in @iov (at most %IOV_MAX)
+ *
+ * Read consecutive blocks starting at @block and scatter their content, in
+ * order, into the buffers of @iov, as a single request. The total size of the
+ * buffers must be a multiple of %BLOCK_SIZE, but individual buffers can be of
+ * any size.
+ *
+ * Return: -1 if @iov is invalid, if one of the blocks is out of bounds or
+ * inaccessible, or if the reading operation fails. 0 otherwise.
+ */
+int block_readv(size_t block, const struct iovec *iov, int iovcnt);
+
+/*
+ * The functions above operate on the one virtual disk opened with
+ * block_disk_open(). The _ex variants below take the disk they operate on as
+ * argument instead, so that a process can have any number of virtual disks
+ * open at the same time.
+ */
+
+/* Opaque virtual disk */
+struct block_disk;
+
+/**
+ * block_disk_open_ex - Open a virtual disk file as a new disk
+ * @diskname: Name of the virtual disk file
+ * @mode: Access mode
+ *
+ * Same as block_disk_open_mode(), but independent from the disk opened by
+ * block_disk_open() and from the other disks opened by this function.
+ *
+ * Return: NULL if @diskname or @mode is invalid, or if the virtual disk file
+ * cannot be opened (or mapped). The new disk otherwise.
+ */
+struct block_disk *block_disk_open_ex(const char *diskname,
+				      enum block_disk_mode mode);
+
+/**
+ * block_disk_close_ex - Close a disk opened by block_disk_open_ex()
+ * @d: Disk to close, which must not be used by other threads anymore
+ *
+ * Return: -1 if @d is NULL. 0 otherwise.
+ */
+int block_disk_close_ex(struct block_disk *d);
+
+/**
+ * block_disk_count_ex - Same as block_disk_count(), on disk @d
+ * @d: Disk
+ */
+int block_disk_count_ex(struct block_disk *d);
+
+/**
+ * block_disk_sync_ex - Same as block_disk_sync(), on disk @d
+ * @d: Disk
+ */
+int block_disk_sync_ex(struct block_disk *d);
+
+/**
+ * block_disk_stats_ex - Same as block_disk_stats(), on disk @d
+ * @d: Disk
+ * @stats: Structure to be filled with the counters
+ */
+int block_disk_stats_ex(struct block_disk *d, struct block_disk_stats *stats);
+
+/**
+ * block_ptr_ex - Same as block_ptr(), on disk @d
+ * @d: Disk
+ * @block: Index of the block
+ */
+void *block_ptr_ex(struct block_disk *d, size_t block);
+
+/**
+ * block_write_ex - Same as block_write(), on disk @d
+ * @d: Disk
+ * @block: Index of the block to write to
+ * @buf: Data buffer to write in the block
+ */
+int block_write_ex(struct block_disk *d, size_t block, const void *buf);
+
+/**
+ * block_read_ex - Same as block_read(), on disk @d
+ * @d: Disk
+ * @block: Index of the block to read from
+ * @buf: Data buffer to be filled with content of block
+ */
+int block_read_ex(struct block_disk *d, size_t block, void *buf);
+
+/**
+ * block_write_range_ex - Same as block_write_range(), on disk @d
+ * @d: Disk
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Data buffer to write in the blocks
+ */
+int block_write_range_ex(struct block_disk *d, size_t block, size_t count,
+			 const void *buf);
+
+/**
+ * block_read_range_ex - Same as block_read_range(), on disk @d
+ * @d: Disk
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Data buffer to be filled with content of blocks
+ */
+int block_read_range_ex(struct block_disk *d, size_t block, size_t count,
+			void *buf);
+
+/**
+ * block_writev_ex - Same as block_writev(), on disk @d
+ * @d: Disk
+ * @block: Index of the first block to write to
+ * @iov: Array of buffers to write in the blocks
+ * @iovcnt: Number of buffers in @iov (at most %IOV_MAX)
+ */
+int block_writev_ex(struct block_disk *d, size_t block,
+		    const struct iovec *iov, int iovcnt);
+
+/**
+ * block_readv_ex - Same as block_readv(), on disk @d
+ * @d: Disk
+ * @block: Index of the first block to read from
+ * @iov: Array of buffers to be filled with content of blocks
+ * @iovcnt: Number of buffers in @iov (at most %IOV_MAX)
+ */
+int block_readv_ex(struct block_disk *d, size_t block,
+		   const struct iovec *iov, int iovcnt);
+
+/**
+ * block_buf_get - Get an I/O buffer
+ *
+ * Get a buffer of %BLOCK_BUF_SIZE bytes aligned on %BLOCK_SIZE, suitable for
+ * any kind of transfer, from a pool of recycled buffers. Buffers can be used by
+ * any thread.
+ *
+ * Return: NULL if no buffer can be allocated. The buffer otherwise.
+ */
+void *block_buf_get(void);
+
+/**
+ * block_buf_put - Give an I/O buffer back
+ * @buf: Buffer obtained from block_buf_get(), or NULL
+ *
+ * Return buffer @buf to the pool, or release it if the pool already holds
+ * enough free buffers.
+ */
+void block_buf_put(void *buf);
+
+/** Maximum number of requests an asynchronous queue can hold */
+#define BLOCK_QUEUE_MAX_DEPTH 256
+
+/* Opaque asynchronous block I/O queue */
+struct block_queue;
+
+/**
+ * enum block_queue_backend - Asynchronous queue implementations
+ * @BLOCK_QUEUE_AUTO: Use io_uring if the kernel supports it, worker threads
+ *                    otherwise
+ * @BLOCK_QUEUE_URING: Submit requests to the kernel through io_uring
+ * @BLOCK_QUEUE_THREADS: Perform requests synchronously in worker threads
+ */
+enum block_queue_backend {
+	BLOCK_QUEUE_AUTO,
+	BLOCK_QUEUE_URING,
+	BLOCK_QUEUE_THREADS,
+};
+
+/**
+ * struct block_io - Asynchronous block request
+ * @block: Index of the first block to transfer
+ * @count: Number of consecutive blocks to transfer
+ * @buf: Data buffer (@count * %BLOCK_SIZE bytes)
+ * @write: Non-zero to write @buf to disk, zero to read into it
+ * @result: Set on completion: 0 if the transfer succeeded, -1 otherwise
+ * @data: Free for the caller's use
+ *
+ * A request, and its buffer, belong to the queue from block_queue_add() until
+ * they are returned by block_queue_reap(). In %BLOCK_DISK_DIRECT mode, a @buf
+ * which is not aligned on %BLOCK_SIZE is transferred through an aligned copy.
+ */
+struct block_io {
+	size_t block;
+	size_t count;
+	void *buf;
+	int write;
+	int result;
+	void *data;
+};
+
+/**
+ * block_queue_create - Create an asynchronous block I/O queue
+ * @depth: Maximum number of requests queued or in flight at the same time (at
+ *         most %BLOCK_QUEUE_MAX_DEPTH)
+ * @backend: Implementation to use
+ *
+ * Create a queue performing requests on the currently open virtual disk, which
+ * must stay open as long as the queue exists. A queue must only be used by one
+ * thread at a time.
+ *
+ * Return: NULL if @depth is invalid, if no virtual disk file is opened, or if
+ * the queue cannot be created with @backend. The new queue otherwise.
+ */
+struct block_queue *block_queue_create(unsigned depth,
+				       enum block_queue_backend backend);
+
+/**
+ * block_queue_create_ex - Create an asynchronous block I/O queue on a disk
+ * @d: Disk the requests go to, which must stay open as long as the queue exists
+ * @depth: Maximum number of requests queued or in flight at the same time
+ * @backend: Implementation to use
+ *
+ * Same as block_queue_create(), for disk @d instead of the currently open one.
+ */
+struct block_queue *block_queue_create_ex(struct block_disk *d, unsigned depth,
+					  enum block_queue_backend backend);
+
+/**
+ * block_queue_destroy - Destroy an asynchronous block I/O queue
+ * @q: Queue to destroy
+ *
+ * Wait for the requests of @q that are in flight, then release it. Requests
+ * that were added but not submitted are dropped.
+ */
+void block_queue_destroy(struct block_queue *q);
+
+/**
+ * block_queue_backend - Get the implementation used by a queue
+ * @q: Queue
+ *
+ * Return: %BLOCK_QUEUE_URING or %BLOCK_QUEUE_THREADS.
+ */
+enum block_queue_backend block_queue_backend(struct block_queue *q);
+
+/**
+ * block_queue_add - Queue an asynchronous block request
+ * @q: Queue
+ * @io: Request
+ *
+ * Add @io to the requests to be sent by the next call to block_queue_submit().
+ *
+ * Return: -1 if @io is out of bounds, or if the queue already holds as many
+ * requests as its depth. 0 otherwise.
+ */
+int block_queue_add(struct block_queue *q, struct block_io *io);
+
+/**
+ * block_queue_submit - Submit queued requests
+ * @q: Queue
+ *
+ * Send all the requests added since the last submission, as one batch. The
+ * requests which cannot be sent complete at once, with a @result of -1, and
+ * are returned by block_queue_reap() like the others.
+ *
+ * Return: -1 if some requests cannot be submitted. Otherwise the number of
+ * requests submitted.
+ */
+int block_queue_submit(struct block_queue *q);
+
+/**
+ * block_queue_reap - Collect completed requests
+ * @q: Queue
+ * @done: Array to be filled with completed requests
+ * @max: Size of @done
+ * @min: Number of completions to wait for (bounded by @max and by the number
+ *       of requests in flight)
+ *
+ * Wait until at least @min submitted requests are complete, then return up to
+ * @max of them in @done. The outcome of each one is in its @result field.
+ *
+ * Return: The number of requests stored in @done.
+ */
+int block_queue_reap(struct block_queue *q, struct block_io **done, int max,
+		     int min);
+
 #endif /* _DISK_H */
 
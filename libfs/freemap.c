@@ -0,0 +1,377 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "freemap.h"
+
+/* Number of bits per word */
+#define WORD_BITS 64
+
+/* Number of runs after the first fit tried by freemap_best_run() */
+#define BEST_FIT_RUNS 8
+
+/*
+ * Free runs of a range of blocks: lengths of the free runs at its start and at
+ * its end, and the first of its longest free runs
+ */
+struct run_node {
+	size_t prefix;
+	size_t suffix;
+	size_t best;
+	size_t start;
+};
+
+/*
+ * Free-space index description
+ *
+ * Bit i of @bits is set if block i is free. Bit j of @summary is set if word j
+ * of @bits is not zero, i.e. has at least one free block. @runs is a complete
+ * binary tree of the free runs of @nleaves words (a power of two), node 1
+ * being the root and node i having nodes 2i and 2i + 1 as children, so that
+ * the longest free run is known without searching.
+ */
+struct freemap {
+	size_t nblocks;
+	size_t nfree;
+	size_t nwords;
+	uint64_t *bits;
+	uint64_t *summary;
+	size_t nleaves;
+	struct run_node *runs;
+};
+
+struct freemap *freemap_create(size_t nblocks)
+{
+	struct freemap *m;
+
+	if (!(m = calloc(1, sizeof(*m))))
+		return NULL;
+
+	m->nblocks = nblocks;
+	m->nwords = (nblocks + WORD_BITS - 1) / WORD_BITS;
+	m->bits = calloc(m->nwords + 1, sizeof(*m->bits));
+	m->summary = calloc(m->nwords / WORD_BITS + 1, sizeof(*m->summary));
+	/* All the blocks are used, which zeroed nodes describe */
+	for (m->nleaves = 1; m->nleaves < m->nwords; m->nleaves *= 2)
+		;
+	m->runs = calloc(2 * m->nleaves, sizeof(*m->runs));
+	if (!m->bits || !m->summary || !m->runs) {
+		freemap_destroy(m);
+		return NULL;
+	}
+
+	return m;
+}
+
+void freemap_destroy(struct freemap *m)
+{
+	if (!m)
+		return;
+
+	free(m->runs);
+	free(m->summary);
+	free(m->bits);
+	free(m);
+}
+
+/* Describe the free runs of word @w of @bits in @n */
+static void leaf_runs(struct freemap *m, size_t w, struct run_node *n)
+{
+	uint64_t word = m->bits[w];
+	size_t pos = 0, len;
+
+	n->prefix = ~word ? __builtin_ctzll(~word) : WORD_BITS;
+	n->suffix = ~word ? __builtin_clzll(~word) : WORD_BITS;
+	n->best = 0;
+	n->start = 0;
+	while (word) {
+		len = __builtin_ctzll(word);
+		word >>= len;
+		pos += len;
+		len = ~word ? __builtin_ctzll(~word) : WORD_BITS - pos;
+		if (len > n->best) {
+			n->best = len;
+			n->start = w * WORD_BITS + pos;
+		}
+		if (pos + len >= WORD_BITS)
+			break;
+		word >>= len;
+		pos += len;
+	}
+}
+
+/*
+ * Describe in @n the free runs of two adjacent ranges of @size blocks each, @l
+ * then @r, @r starting at block @first
+ */
+static void merge_runs(struct run_node *n, const struct run_node *l,
+		       const struct run_node *r, size_t size, size_t first)
+{
+	size_t across = l->suffix + r->prefix;
+
+	n->prefix = l->prefix == size ? size + r->prefix : l->prefix;
+	n->suffix = r->suffix == size ? size + l->suffix : r->suffix;
+
+	/* The first of the longest runs wins */
+	n->best = l->best;
+	n->start = l->start;
+	if (across > n->best) {
+		n->best = across;
+		n->start = first - l->suffix;
+	}
+	if (r->best > n->best) {
+		n->best = r->best;
+		n->start = r->start;
+	}
+}
+
+/* Update the tree of free runs after word @w of @bits changed */
+static void update_runs(struct freemap *m, size_t w)
+{
+	size_t i = m->nleaves + w, level = m->nleaves, size = WORD_BITS;
+
+	leaf_runs(m, w, &m->runs[i]);
+	for (i /= 2; i; i /= 2, level /= 2, size *= 2)
+		merge_runs(&m->runs[i], &m->runs[2 * i], &m->runs[2 * i + 1],
+			   size, (2 * i + 1 - level) * size);
+}
+
+void freemap_set_free(struct freemap *m, size_t block)
+{
+	size_t w = block / WORD_BITS;
+
+	m->bits[w] |= 1ULL << (block % WORD_BITS);
+	m->summary[w / WORD_BITS] |= 1ULL << (w % WORD_BITS);
+	m->nfree++;
+	update_runs(m, w);
+}
+
+void freemap_set_free_mask(struct freemap *m, size_t block, uint64_t mask)
+{
+	size_t w = block / WORD_BITS;
+
+	if (!mask)
+		return;
+
+	m->bits[w] |= mask;
+	m->summary[w / WORD_BITS] |= 1ULL << (w % WORD_BITS);
+	m->nfree += __builtin_popcountll(mask);
+	update_runs(m, w);
+}
+
+void freemap_set_used(struct freemap *m, size_t block)
+{
+	size_t w = block / WORD_BITS;
+
+	m->bits[w] &= ~(1ULL << (block % WORD_BITS));
+	if (!m->bits[w])
+		m->summary[w / WORD_BITS] &= ~(1ULL << (w % WORD_BITS));
+	m->nfree--;
+	update_runs(m, w);
+}
+
+int freemap_is_free(struct freemap *m, size_t block)
+{
+	return (m->bits[block / WORD_BITS] >> (block % WORD_BITS)) & 1;
+}
+
+size_t freemap_count(struct freemap *m)
+{
+	return m->nfree;
+}
+
+size_t freemap_count_range(struct freemap *m, size_t block, size_t len)
+{
+	size_t count = 0, w, bit, n;
+	uint64_t word;
+
+	if (len > m->nblocks - block)
+		len = m->nblocks - block;
+
+	/* Count the free bits of each word overlapping the range */
+	while (len) {
+		w = block / WORD_BITS;
+		bit = block % WORD_BITS;
+		n = WORD_BITS - bit < len ? WORD_BITS - bit : len;
+		word = m->bits[w] >> bit;
+		if (n < WORD_BITS)
+			word &= (1ULL << n) - 1;
+		count += __builtin_popcountll(word);
+		block += n;
+		len -= n;
+	}
+
+	return count;
+}
+
+/* Find the first word at or after @w with a free block, -1 if none */
+static long next_word(struct freemap *m, size_t w)
+{
+	size_t s = w / WORD_BITS;
+	uint64_t sum;
+
+	if (w >= m->nwords)
+		return -1;
+
+	sum = m->summary[s] & (~0ULL << (w % WORD_BITS));
+	while (!sum) {
+		if (++s * WORD_BITS >= m->nwords)
+			return -1;
+		sum = m->summary[s];
+	}
+
+	return s * WORD_BITS + __builtin_ctzll(sum);
+}
+
+long freemap_find(struct freemap *m, size_t from)
+{
+	size_t w = from / WORD_BITS;
+	uint64_t word;
+	long next;
+
+	if (from >= m->nblocks)
+		return -1;
+
+	/* Rest of the word holding @from */
+	word = m->bits[w] & (~0ULL << (from % WORD_BITS));
+	if (word)
+		return w * WORD_BITS + __builtin_ctzll(word);
+
+	/* Following words, skipping the full ones with the summary */
+	if ((next = next_word(m, w + 1)) < 0)
+		return -1;
+
+	return next * WORD_BITS + __builtin_ctzll(m->bits[next]);
+}
+
+size_t freemap_run_length(struct freemap *m, size_t block, size_t max)
+{
+	size_t len = 0, w, bit;
+	uint64_t used;
+
+	if (max > m->nblocks - block)
+		max = m->nblocks - block;
+
+	/* Count free bits up to the first used one, a word at a time */
+	while (len < max) {
+		w = (block + len) / WORD_BITS;
+		bit = (block + len) % WORD_BITS;
+		used = ~m->bits[w] >> bit;
+		if (used) {
+			len += __builtin_ctzll(used);
+			break;
+		}
+		len += WORD_BITS - bit;
+	}
+
+	return len < max ? len : max;
+}
+
+long freemap_find_run(struct freemap *m, size_t len, size_t from)
+{
+	long start;
+	size_t found;
+
+	if (!len)
+		return -1;
+
+	while ((start = freemap_find(m, from)) >= 0) {
+		found = freemap_run_length(m, start, len);
+		if (found == len)
+			return start;
+		from = start + found;
+	}
+
+	return -1;
+}
+
+/*
+ * Find the first run of at least @len free blocks within word @w, which must
+ * hold one
+ */
+static size_t leaf_first_fit(struct freemap *m, size_t w, size_t len)
+{
+	uint64_t word = m->bits[w];
+	size_t pos = 0, run;
+
+	for (;;) {
+		run = __builtin_ctzll(word);
+		word >>= run;
+		pos += run;
+		run = ~word ? __builtin_ctzll(~word) : WORD_BITS - pos;
+		if (run >= len)
+			return w * WORD_BITS + pos;
+		word >>= run;
+		pos += run;
+	}
+}
+
+/*
+ * Find the first run of at least @len free blocks, -1 if none, by descending
+ * to the leftmost node of the tree of free runs which holds one
+ */
+static long first_fit(struct freemap *m, size_t len)
+{
+	size_t i = 1, size = m->nleaves * WORD_BITS, first = 0;
+	const struct run_node *l, *r;
+
+	if (m->runs[1].best < len)
+		return -1;
+
+	while (i < m->nleaves) {
+		l = &m->runs[2 * i];
+		r = &m->runs[2 * i + 1];
+		size /= 2;
+		if (l->best >= len) {
+			i = 2 * i;
+			continue;
+		}
+		/* The run spanning both children starts in the left one */
+		if (l->suffix + r->prefix >= len)
+			return first + size - l->suffix;
+		i = 2 * i + 1;
+		first += size;
+	}
+
+	return leaf_first_fit(m, i - m->nleaves, len);
+}
+
+long freemap_best_run(struct freemap *m, size_t len, size_t *found)
+{
+	long start, best;
+	size_t from, run, best_len;
+	int i;
+
+	if (!len)
+		len = 1;
+
+	/* No run fits: the longest one is known without searching */
+	if ((best = first_fit(m, len)) < 0)
+		return freemap_longest_run(m, found);
+
+	/* Only the runs following the first fit are tried for a tighter one */
+	best_len = freemap_run_length(m, best, m->nblocks);
+	from = best + best_len;
+	for (i = 0; i < BEST_FIT_RUNS && best_len > len; i++) {
+		if ((start = freemap_find(m, from)) < 0)
+			break;
+		run = freemap_run_length(m, start, m->nblocks);
+		if (run >= len && run < best_len) {
+			best = start;
+			best_len = run;
+		}
+		from = start + run;
+	}
+
+	if (found)
+		*found = best_len;
+
+	return best;
+}
+
+long freemap_longest_run(struct freemap *m, size_t *found)
+{
+	if (found)
+		*found = m->runs[1].best;
+
+	return m->runs[1].best ? (long)m->runs[1].start : -1;
+}
@@ -0,0 +1,140 @@
+#ifndef _FREEMAP_H
+#define _FREEMAP_H
+
+#include <stddef.h> /* for size_t definition */
+#include <stdint.h> /* for uint64_t definition */
+
+/* Opaque free-space index */
+struct freemap;
+
+/**
+ * freemap_create - Create a free-space index
+ * @nblocks: Number of blocks tracked by the index
+ *
+ * Create an index of which of @nblocks blocks are free. All the blocks start
+ * as used. Internally, it is a bitmap with a summary word for every 64 bitmap
+ * words, so that searches skip fully used regions 4096 blocks at a time, and a
+ * tree of the free runs of the bitmap words, so that the longest one is known.
+ *
+ * Return: NULL if memory cannot be allocated. The new index otherwise.
+ */
+struct freemap *freemap_create(size_t nblocks);
+
+/**
+ * freemap_destroy - Destroy a free-space index
+ * @m: Index to destroy
+ */
+void freemap_destroy(struct freemap *m);
+
+/**
+ * freemap_set_free - Mark a block as free
+ * @m: Index
+ * @block: Block to mark (must be used)
+ */
+void freemap_set_free(struct freemap *m, size_t block);
+
+/**
+ * freemap_set_free_mask - Mark a group of blocks as free
+ * @m: Index
+ * @block: First block of the group (must be a multiple of 64)
+ * @mask: Blocks to mark, bit i standing for block @block + i (must be used)
+ *
+ * Same as calling freemap_set_free() on each block of @mask, a word at a time.
+ */
+void freemap_set_free_mask(struct freemap *m, size_t block, uint64_t mask);
+
+/**
+ * freemap_set_used - Mark a block as used
+ * @m: Index
+ * @block: Block to mark (must be free)
+ */
+void freemap_set_used(struct freemap *m, size_t block);
+
+/**
+ * freemap_is_free - Check whether a block is free
+ * @m: Index
+ * @block: Block to check
+ *
+ * Return: 1 if @block is free, 0 otherwise.
+ */
+int freemap_is_free(struct freemap *m, size_t block);
+
+/**
+ * freemap_count - Get the number of free blocks
+ * @m: Index
+ *
+ * Return: The number of free blocks, in constant time.
+ */
+size_t freemap_count(struct freemap *m);
+
+/**
+ * freemap_count_range - Get the number of free blocks in a range
+ * @m: Index
+ * @block: First block of the range
+ * @len: Number of blocks in the range
+ *
+ * Return: The number of free blocks from @block to @block + @len - 1.
+ */
+size_t freemap_count_range(struct freemap *m, size_t block, size_t len);
+
+/**
+ * freemap_find - Find a free block
+ * @m: Index
+ * @from: Block to start searching from
+ *
+ * Return: -1 if no block at or after @from is free. The index of the first free
+ * block at or after @from otherwise.
+ */
+long freemap_find(struct freemap *m, size_t from);
+
+/**
+ * freemap_find_run - Find a run of free blocks
+ * @m: Index
+ * @len: Number of contiguous free blocks needed
+ * @from: Block to start searching from
+ *
+ * Return: -1 if there is no run of @len free blocks at or after @from.
+ * Otherwise the index of the first block of the first such run.
+ */
+long freemap_find_run(struct freemap *m, size_t len, size_t from);
+
+/**
+ * freemap_best_run - Find the best-fitting run of free blocks
+ * @m: Index
+ * @len: Number of contiguous free blocks wanted
+ * @found: Filled with the length of the returned run (may be NULL)
+ *
+ * Find the first run of free blocks holding at least @len blocks, in
+ * logarithmic time, or a shorter one that still fits among the few runs that
+ * follow it. If no run is that long, find the longest one instead.
+ *
+ * Return: -1 if no block is free. The index of the first block of the run
+ * otherwise.
+ */
+long freemap_best_run(struct freemap *m, size_t len, size_t *found);
+
+/**
+ * freemap_longest_run - Find the longest run of free blocks
+ * @m: Index
+ * @found: Filled with the length of the returned run (may be NULL)
+ *
+ * Same as freemap_best_run() with a length no run reaches, in constant time:
+ * the longest run is kept up to date as blocks are marked free or used, in
+ * logarithmic time.
+ *
+ * Return: -1 if no block is free. The index of the first block of the first
+ * longest run otherwise.
+ */
+long freemap_longest_run(struct freemap *m, size_t *found);
+
+/**
+ * freemap_run_length - Measure a run of free blocks
+ * @m: Index
+ * @block: First block of the run
+ * @max: Length at which to stop measuring
+ *
+ * Return: The number of contiguous free blocks starting at @block, up to @max.
+ */
+size_t freemap_run_length(struct freemap *m, size_t block, size_t max);
+
+#endif /* _FREEMAP_H */
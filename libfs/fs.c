@@ -1,14 +1,22 @@
+#define _GNU_SOURCE /* for IOV_MAX */
+
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 
+#include "cache.h"
+#include "counters.h"
 #include "disk.h"
+#include "freemap.h"
 #include "fs.h"
+#include "trace.h"
 
 #include <stdbool.h>
-#define FS_DEBUG false
 
 /*define constants*/
 #define BLOCK_BYTES 4096
@@ -16,6 +24,16 @@
 #define SIGNATURE_CHECK "ECS150FS"
 #define FILENAME_MAX_SIZE 16
 #define MAX_OPEN_FILE_DESCRIPTORS 32
+#define RUN_MAX_BLOCKS BLOCK_BUF_BLOCKS
+#define FAT_ENTRIES_PER_BLOCK (BLOCK_BYTES / 2)
+#define MAX_FAT_BLOCKS 32
+#define READAHEAD_MIN_BLOCKS 4
+#define READAHEAD_MAX_BLOCKS 32
+#define WRITE_BUFFER_BYTES (RUN_MAX_BLOCKS * BLOCK_BYTES)
+#define HINT_MAGIC 0x544e4948
+#define JOURNAL_MAGIC 0x4c4e524a
+#define JOURNAL_FAT 1
+#define JOURNAL_ENTRY 2
 
 /*define data structures for meta-information blocks*/
 //packed data structure for superblock
@@ -26,7 +44,13 @@ struct __attribute__((__packed__)) superBlock {
     uint16_t dataIndex;                         //Data block start index
     uint16_t numDBlocks;                        //Amount of data blocks
     uint8_t numFBlocks;                         //Number of blocks for FAT
-    int8_t unused[4079];                        //Unused/Padding
+    uint32_t hintMagic;                         //HINT_MAGIC if freeHint matches the FAT
+    uint16_t freeHint[MAX_FAT_BLOCKS];          //free data blocks of each FAT block
+    uint32_t journalMagic;                      //JOURNAL_MAGIC if the volume has a journal
+    uint16_t journalStart;                      //first data block of the journal
+    uint16_t journalBlocks;                     //number of data blocks of the journal
+    uint32_t journalSeq;                        //sequence number of the first transaction to replay
+    int8_t unused[3999];                        //Unused/Padding
 };
 
 //packed data structure for file information
@@ -42,673 +66,3039 @@ struct __attribute__((__packed__)) rootDirectory {
     struct fileInfo files[NUM_ROOTDIR_ENTRIES];         //entries of file informations
 };
 
-//packed structure for basic file descriptor
-struct __attribute__((__packed__)) fileDescriptor {
-    int8_t filename[FILENAME_MAX_SIZE];
-    int offset;
+//packed header of a journal transaction, at the start of its first block. its
+//records follow: a type byte, then for JOURNAL_FAT the first FAT entry and the
+//number of entries (uint16_t each) followed by their values, and for
+//JOURNAL_ENTRY the index of a root directory entry (uint8_t) followed by it
+struct __attribute__((__packed__)) journalHeader {
+    uint32_t magic;                             //JOURNAL_MAGIC
+    uint32_t seq;                               //sequence number of the transaction
+    uint32_t length;                            //number of bytes of records
+    uint32_t checksum;                          //hash of seq, length and the records
+};
+
+//position in the FAT chain of a file, so that a walk can start from there
+struct chainCursor {
+    uint16_t index;                             //data block of the cursor
+    int block;                                  //logical block number of index
+};
+
+//structure for file descriptor. it remembers the file's root directory entry
+//and a cursor on the FAT chain, so that I/O continues where the last one ended
+struct fileDescriptor {
+    bool opened;                                //whether descriptor is in use
+    int fileIndex;                              //root directory entry of the file
+    int offset;                                 //file offset
+    struct chainCursor cursor;                  //last block accessed
+    int raLast;                                 //last logical block read
+    int raEnd;                                  //logical block where readahead stopped
+    int raWindow;                               //number of blocks to read ahead
+    size_t raHits;                              //reads served by readahead
+    size_t raMisses;                            //reads not served by readahead
+};
+
+//map from logical block number to data block of a file, built on first access
+//and shared by all the descriptors opened on the file
+struct blockMap {
+    uint16_t *blocks;                           //data block of each logical block
+    int count;                                  //number of blocks in the file's chain
+    int capacity;                               //number of entries allocated
+    int users;                                  //number of descriptors on the file
+};
+
+//delayed writes of a file, a range of bytes not written to disk yet. it is
+//shared by all the descriptors opened on the file
+struct writeBuffer {
+    char *data;                                 //bytes of the range
+    int start;                                  //file offset of the range
+    int length;                                 //length of the range
+    int reserved;                               //blocks reserved to write it
+};
+
+//position in the buffers of a vectored transfer, which are used in order as
+//if they were a single buffer
+struct ioVector {
+    const struct iovec *iov;                    //buffers of the transfer
+    int count;                                  //number of buffers
+    int current;                                //buffer holding the position
+    size_t offset;                              //position in that buffer
+};
+
+//size of the hash index from filename to root directory entry
+#define NAME_INDEX_SIZE (2 * NUM_ROOTDIR_ENTRIES)
+
+//counters of a file system: for each timed operation, its calls, errors, time
+//and latency histogram, then the counters of the whole file system
+#define STAT_OP_FIELDS (3 + FS_STATS_BUCKETS)
+#define STAT_CALLS(op) ((op) * STAT_OP_FIELDS)
+#define STAT_ERRORS(op) ((op) * STAT_OP_FIELDS + 1)
+#define STAT_NS(op) ((op) * STAT_OP_FIELDS + 2)
+#define STAT_LATENCY(op, bucket) ((op) * STAT_OP_FIELDS + 3 + (bucket))
+#define STAT_BYTES_READ (FS_OP_COUNT * STAT_OP_FIELDS)
+#define STAT_BYTES_WRITTEN (STAT_BYTES_READ + 1)
+#define STAT_FAT_HOPS (STAT_BYTES_READ + 2)
+#define STAT_DIR_ENTRIES (STAT_BYTES_READ + 3)
+#define NUM_STATS (STAT_BYTES_READ + 4)
+
+//mounted file system. every function works on the one it is given, so that
+//several volumes can be mounted at the same time
+struct fs {
+    /*intialize variables for meta-information blocks*/
+    struct block_disk *disk;
+    struct superBlock *sb;
+    uint16_t *fat;
+    struct rootDirectory *root;
+    struct fileDescriptor openedFiles[MAX_OPEN_FILE_DESCRIPTORS];
+    struct cache *cache;
+    //whether meta-information blocks are accessed in place in the disk mapping
+    bool metaMapped;
+    //index of free data blocks, kept in sync with the FAT
+    struct freemap *freeMap;
+    //operation and file system counters, sharded by thread
+    struct counters *stats;
+    //largest readahead window, limited so that readahead doesn't flush the cache
+    int readaheadMax;
+    //root directory entry where the next defragmentation pass starts, and
+    //the one being moved, which cannot be deleted meanwhile (-1 if none)
+    int defragNext;
+    int defragFile;
+    //meta-information blocks changed since they were last written to disk
+    bool fatDirty[MAX_FAT_BLOCKS];
+    bool rootDirty;
+    //FAT blocks read from disk, and FAT blocks whose free entries were added
+    //to the free-space index, one bit per FAT block. both happen on first
+    //use, so that mounting doesn't depend on the size of the volume
+    uint32_t fatLoaded;
+    uint32_t fatScanned;
+    //free data blocks of the FAT blocks not scanned yet, from the hints of
+    //the superblock, and their total
+    int freeHint[MAX_FAT_BLOCKS];
+    int hintedFree;
+    //whether the hints of the superblock on disk are valid
+    bool hintOnDisk;
+
+    //metadata journal, used unless meta-information is accessed in place:
+    //block where the next transaction goes and its sequence number, number of
+    //blocks kept free for the largest transaction, and buffer of a transaction
+    bool journaled;
+    int journalHead;
+    uint32_t journalSeq;
+    int journalReserve;
+    char *journalBuf;
+    //FAT entries and root directory entries changed since they were last
+    //logged or written to disk, one bit each
+    uint64_t fatUnlogged[MAX_FAT_BLOCKS * FAT_ENTRIES_PER_BLOCK / 64];
+    uint64_t rootUnlogged[NUM_ROOTDIR_ENTRIES / 64];
+    //group commit: syncs arrived so far, syncs covered by the last one to
+    //complete and its result, and whether one is running
+    uint64_t syncArrived;
+    uint64_t syncCovered;
+    int syncResult;
+    bool syncRunning;
+
+    //block maps and delayed writes of the files, by root directory entry
+    struct blockMap blockMaps[NUM_ROOTDIR_ENTRIES];
+    struct writeBuffer writeBuffers[NUM_ROOTDIR_ENTRIES];
+    //whether writes are delayed, and number of free blocks reserved for them
+    bool delayedAlloc;
+    int reservedBlocks;
+
+    //hash index from filename to root directory entry. slots hold entry
+    //indexes, or -1 when empty, and collisions are resolved by linear probing
+    int16_t nameIndex[NAME_INDEX_SIZE];
+
+    /*LOCKS*/
+    //the root directory, the name index and the descriptor table are protected
+    //by dirLock, held for reading by lookups. the FAT, the free-space index and
+    //the reservations of delayed writes are protected by fatLock. the data,
+    //block map and delayed writes of a file are protected by its file lock,
+    //held for reading by reads. locks are taken in this order: file lock,
+    //dirLock, fatLock. mount and unmount must not run concurrently with other
+    //calls on the file system
+    pthread_rwlock_t dirLock;
+    pthread_mutex_t fatLock;
+    pthread_rwlock_t fileLocks[NUM_ROOTDIR_ENTRIES];
+    //serializes the building of block maps by concurrent readers
+    pthread_mutex_t mapLock;
+    //serializes the loading of FAT blocks, taken last
+    pthread_mutex_t fatLoadLock;
+    //serializes defragmentation passes
+    pthread_mutex_t defragLock;
+    //protects the group commit state, signaled when a sync completes
+    pthread_mutex_t syncLock;
+    pthread_cond_t syncDone;
 };
 
-/*intialize variables for meta-information blocks*/
-struct superBlock *sb;
-uint16_t *fat;
-struct rootDirectory *root;
-struct fileDescriptor openedFiles[MAX_OPEN_FILE_DESCRIPTORS];
+//file system used by the functions without a file system argument
+static fs_t *mounted;
 
 /*functions*/
-//mounts the passed file system
-int fs_mount(const char *diskname)
-{
-    //check if disk can be opened
-    if (block_disk_open(diskname) == -1) {
-        return -1;
-    }
+static int fs_flushBuffer(fs_t *fs, int fd);
 
-	//if disk is successfully opened, then intialize meta-information
-    sb = (struct superBlock*)malloc(sizeof(struct superBlock));
+//returns the current time in nanoseconds, for timing operations
+static uint64_t fs_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    /*SUPERBLOCK*/
-    //check if superblock can be read
-    if (block_read(0, sb) == -1) {
-        return -1;
-    }
-    //checking signature
-    for (int i = 0; SIGNATURE_CHECK[i] != '\0'; i++) { 
-        if ((char)(sb->signature[i]) != SIGNATURE_CHECK[i]) {
-            return -1;
-        }
-    }
-    //checking total amount of blocks of virtual disk
-    if (sb->numBlocks != block_disk_count()) {
-        return -1;
-    }
-    //checking if numFBlocks is correct
-    int expectedFB = (sb->numDBlocks * 2) / 4096;
-    if ((sb->numDBlocks * 2) % 4096 > 0) {
-        expectedFB++;
-    }
-    if (sb->numFBlocks != expectedFB) {
-        return -1;
-    }
-    //checking if rootIndex is correct
-    if (sb->rootIndex != 1 + sb->numFBlocks) {
-        return -1;
+//records a call to op which started at start and returned ret
+static void fs_recordOp(fs_t *fs, enum fs_op op, uint64_t start, int ret)
+{
+    if (fs == NULL) {
+        return;
     }
-    //checking if rootIndex is correct
-    if (sb->dataIndex != 1 + sb->rootIndex) {
-        return -1;
+    uint64_t ns = fs_now() - start;
+    //bucket of the latency is the position of its highest bit
+    int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+    if (bucket >= FS_STATS_BUCKETS) {
+        bucket = FS_STATS_BUCKETS - 1;
     }
-    //checking if numDBlocks is correct
-    if (sb->numDBlocks != sb->numBlocks - sb->dataIndex) {
-        return -1;
+    counters_add(fs->stats, STAT_CALLS(op), 1);
+    counters_add(fs->stats, STAT_NS(op), ns);
+    counters_add(fs->stats, STAT_LATENCY(op, bucket), 1);
+    if (ret == -1) {
+        counters_add(fs->stats, STAT_ERRORS(op), 1);
     }
-    
-    /*FILE ALLOCATION TABLE*/
-    fat = (uint16_t*)malloc(sizeof(struct superBlock) * sb->numFBlocks);
-    //check if file allocation table can be read
-    //cycle through each FAT block and read
-    int fatIndex = 1;
-    for (int i = 0; i < sb->numFBlocks; i++) {
-        if (block_read(fatIndex, fat + ((BLOCK_BYTES / 2) * i)) == -1) {
-            return -1;
-        }
-        fatIndex++;
+    TRACE(OP_END, op, ret, ns / 1000);
+}
+
+//adds hops FAT entries followed to the counters
+static void fs_countHops(fs_t *fs, size_t hops)
+{
+    if (hops > 0) {
+        counters_add(fs->stats, STAT_FAT_HOPS, hops);
     }
+}
 
-    /*ROOT DIRECTORY*/
-    root = (struct rootDirectory*)malloc(sizeof(struct rootDirectory));
-    //check if root directory can be read
-    if (block_read(sb->rootIndex, root) == -1) {
-        return -1;
+//adds entries root directory entries examined to the counters
+static void fs_countEntries(fs_t *fs, size_t entries)
+{
+    counters_add(fs->stats, STAT_DIR_ENTRIES, entries);
+}
+
+//hashes a filename (FNV-1a) into a name index slot
+static int fs_hashName(const char *filename)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < FILENAME_MAX_SIZE && filename[i] != '\0'; i++) {
+        hash = (hash ^ (uint8_t)filename[i]) * 16777619u;
     }
-    //return 0 if successfully mounted
-    return 0;
+    return hash % NAME_INDEX_SIZE;
 }
 
-int fs_umount(void)
+//returns the root directory entry of filename, or -1 if there is none. dirLock
+//must be held, as for the other name index functions
+static int fs_lookup(fs_t *fs, const char *filename)
 {
-    /*WRITING BACK TO DISK*/
-	//write superblock back to disk
-    if (block_write(0, sb) == -1) {
+    if (filename == NULL || filename[0] == '\0') {
         return -1;
     }
-       
-    //write file allocation table data back to disk
-    int fatIndex = 1;
-    for (int i = 0; i < sb->numFBlocks; i++) {
-        if (block_write(fatIndex, fat + ((BLOCK_BYTES / 2) * i)) == -1) {
-            return -1;
+    int probes = 0;
+    int fileIndex = -1;
+    int home = fs_hashName(filename);
+    for (int slot = home; fs->nameIndex[slot] != -1;
+        slot = (slot + 1) % NAME_INDEX_SIZE) {
+        char *tempname = (char*)fs->root->files[fs->nameIndex[slot]].filename;
+        probes++;
+        if (strncmp(filename, tempname, FILENAME_MAX_SIZE) == 0) {
+            fileIndex = fs->nameIndex[slot];
+            break;
         }
-        fatIndex++;
-    }
-    //write root directory back to disk
-    if (block_write(sb->rootIndex, root) == -1) {
-        return -1;
     }
-        
-    /*FREEING VARIABLES*/
-    free(sb);
-    free(fat);
-    free(root);
+    fs_countEntries(fs, probes);
+    TRACE(LOOKUP, home, probes, fileIndex);
+    return fileIndex;
+}
 
-    //close disk
-    if (block_disk_close() == -1) {
-        return -1;
+//adds root directory entry fileIndex to the name index
+static void fs_indexInsert(fs_t *fs, int fileIndex)
+{
+    int slot = fs_hashName((char*)fs->root->files[fileIndex].filename);
+    while (fs->nameIndex[slot] != -1) {
+        slot = (slot + 1) % NAME_INDEX_SIZE;
     }
-
-    //return 0 if successfully unmounted
-    return 0;
+    fs->nameIndex[slot] = fileIndex;
 }
 
-int fs_info(void)
+//removes root directory entry fileIndex from the name index
+static void fs_indexRemove(fs_t *fs, int fileIndex)
 {
-	//check if a virtual disk was opened
-    if (sb == NULL) {
-        return -1;
+    int slot = fs_hashName((char*)fs->root->files[fileIndex].filename);
+    while (fs->nameIndex[slot] != fileIndex) {
+        slot = (slot + 1) % NAME_INDEX_SIZE;
     }
-
-    //printing basic info
-    printf("FS Info:\n");
-    printf("total_blk_count=%d\n", sb->numBlocks);
-    printf("fat_blk_count=%d\n", sb->numFBlocks);
-    printf("rdir_blk=%d\n", sb->rootIndex);
-    printf("data_blk=%d\n", sb->dataIndex);
-    printf("data_blk_count=%d\n", sb->numDBlocks);
-
-    //calculating fat free ratio
-    int freeFat = 0;
-    for (int i = 0; i < sb->numDBlocks; i++) {
-        if (fat[i] == 0) {
-            freeFat++;
+    //shift back following entries that would no longer be reachable
+    int hole = slot;
+    for (slot = (slot + 1) % NAME_INDEX_SIZE; fs->nameIndex[slot] != -1;
+        slot = (slot + 1) % NAME_INDEX_SIZE) {
+        int home = fs_hashName((char*)fs->root->files[fs->nameIndex[slot]].filename);
+        //entry can move to the hole if its home is not in (hole, slot]
+        if ((slot > hole && (home <= hole || home > slot)) ||
+            (slot < hole && (home <= hole && home > slot))) {
+            fs->nameIndex[hole] = fs->nameIndex[slot];
+            hole = slot;
         }
     }
-    printf("fat_free_ratio=%d/%d\n", freeFat, sb->numDBlocks);
+    fs->nameIndex[hole] = -1;
+}
 
-    //calculate rdir free ratio
-    //set variable as max possible. cycle through and decrement for each empty fd
-    int freeFd = 0;
-    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
-        if ((root->files[i].filename[0]) == '\0') {
-            freeFd++;
+//reads FAT block page from disk, unless another thread just did
+static int fs_loadFat(fs_t *fs, int page)
+{
+    int ret = 0;
+    pthread_mutex_lock(&fs->fatLoadLock);
+    if (!(__atomic_load_n(&fs->fatLoaded, __ATOMIC_RELAXED) & (1u << page))) {
+        ret = block_read_ex(fs->disk, 1 + page, fs->fat + FAT_ENTRIES_PER_BLOCK * page);
+        if (ret == 0) {
+            //published after the entries, for readers that don't lock
+            __atomic_or_fetch(&fs->fatLoaded, 1u << page, __ATOMIC_RELEASE);
         }
     }
-    printf("rdir_free_ratio=%d/%d\n", freeFd, NUM_ROOTDIR_ENTRIES);
-
-    //return 0 if info has been successfully printed
-    return 0;
+    pthread_mutex_unlock(&fs->fatLoadLock);
+    return ret;
 }
 
-int fs_create(const char *filename)
+//returns FAT entry index, reading its FAT block on first access. an entry
+//whose block cannot be read ends the chain
+static uint16_t fs_getFat(fs_t *fs, uint16_t index)
 {
-    /*FILENAME CHECKING*/
-    //check if filename is valid or too long
-    if (strlen(filename) > FILENAME_MAX_SIZE || filename == NULL) {
-        return -1;
-    }
-    //check if filename is a duplicate
-    char *tempname;
-	for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
-        tempname = (char*)root->files[i].filename;
-        if(strcmp(filename, tempname) == 0) {
-            return -1;
-        }
+    int page = index / FAT_ENTRIES_PER_BLOCK;
+    if (!(__atomic_load_n(&fs->fatLoaded, __ATOMIC_ACQUIRE) & (1u << page)) &&
+        fs_loadFat(fs, page) == -1) {
+        return 0xFFFF;
     }
+    return fs->fat[index];
+}
 
-    /*SEARCHING FOR OPEN ROOT DIRECTORY ENTRY*/
-    //if checks pass, then find open root directory entry
-    int freeEntryIndex = -1;
-    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
-        if ((root->files[i].filename[0]) == '\0') {
-            freeEntryIndex = i;
-            break;
-        }
+//invalidates the free-space hints of the superblock on disk, before the FAT on
+//disk changes. fatLock must be held
+static int fs_dropHints(fs_t *fs)
+{
+    if (!fs->hintOnDisk) {
+        return 0;
     }
-    //if no entries were open, then return -1
-    if (freeEntryIndex == -1) {
+    fs->sb->hintMagic = 0;
+    if (!fs->metaMapped && block_write_ex(fs->disk, 0, fs->sb) == -1) {
+        fs->sb->hintMagic = HINT_MAGIC;
         return -1;
     }
+    fs->hintOnDisk = false;
+    return 0;
+}
 
+//sets FAT entry index and marks its FAT block dirty. fatLock must be held
+static void fs_setFat(fs_t *fs, uint16_t index, uint16_t value)
+{
+    //the rest of the block must be loaded before it is written back, and
+    //changes to the mapping are immediately on disk
+    fs_getFat(fs, index);
+    if (fs->metaMapped) {
+        fs_dropHints(fs);
+    }
+    fs->fat[index] = value;
+    fs->fatDirty[index / FAT_ENTRIES_PER_BLOCK] = true;
+    fs->fatUnlogged[index / 64] |= 1ULL << (index % 64);
+}
 
+//marks root directory entry fileIndex changed. dirLock must be held for writing
+static void fs_dirtyEntry(fs_t *fs, int fileIndex)
+{
+    fs->rootDirty = true;
+    fs->rootUnlogged[fileIndex / 64] |= 1ULL << (fileIndex % 64);
+}
 
-    /*MANAGING INFO IN NEW ENTRY*/
-    //updating filename and size for new entry
-    strcpy((char*)root->files[freeEntryIndex].filename, filename);
-    root->files[freeEntryIndex].size = 0;
-    
-    //find an empty spot in FAT to set to firstIndex
-    int freeFATIndex = -1;
-    for (int i = 0; i < sb->numDBlocks; i++) {
-        if (fat[i] == 0) {
-            freeFATIndex = i;
-            fat[i] = 0xFFFF;
-            break;
+//adds the free entries of FAT block page to the free-space index, if it was
+//not done yet. fatLock must be held, as for the other scanning functions
+static void fs_scanFat(fs_t *fs, int page)
+{
+    if (fs->fatScanned & (1u << page)) {
+        return;
+    }
+    if (!(__atomic_load_n(&fs->fatLoaded, __ATOMIC_ACQUIRE) & (1u << page)) &&
+        fs_loadFat(fs, page) == -1) {
+        return;
+    }
+    //a word of the index at a time
+    int first = page * FAT_ENTRIES_PER_BLOCK;
+    int last = first + FAT_ENTRIES_PER_BLOCK < fs->sb->numDBlocks ?
+        first + FAT_ENTRIES_PER_BLOCK : fs->sb->numDBlocks;
+    for (int group = first; group < last; group += 64) {
+        int count = last - group < 64 ? last - group : 64;
+        uint64_t mask = 0;
+        int i = 0;
+        //four entries at a time: the top bit of a lane is set if it is zero,
+        //then the four top bits are gathered in the low bits
+        for (; i + 4 <= count; i += 4) {
+            uint64_t lanes, low = 0x7FFF7FFF7FFF7FFFULL;
+            memcpy(&lanes, &fs->fat[group + i], sizeof(lanes));
+            uint64_t zero = ~(((lanes & low) + low) | lanes) & ~low;
+            zero >>= 15;
+            mask |= ((zero | zero >> 15 | zero >> 30 | zero >> 45) & 0xF) << i;
+        }
+        for (; i < count; i++) {
+            mask |= (uint64_t)(fs->fat[group + i] == 0) << i;
         }
+        freemap_set_free_mask(fs->freeMap, group, mask);
     }
-    //if no space in FAT is open
-    if (freeFATIndex == -1) {
-        return -1;
+    fs->hintedFree -= fs->freeHint[page];
+    fs->freeHint[page] = 0;
+    fs->fatScanned |= 1u << page;
+}
+
+//adds the free entries of every FAT block to the free-space index, for
+//searches that look at the whole index
+static void fs_scanAll(fs_t *fs)
+{
+    //FAT blocks not loaded yet are read together, consecutive ones in a
+    //single request
+    pthread_mutex_lock(&fs->fatLoadLock);
+    uint32_t loaded = __atomic_load_n(&fs->fatLoaded, __ATOMIC_RELAXED);
+    int page = 0;
+    while (page < fs->sb->numFBlocks) {
+        if (loaded & (1u << page) || fs->fatScanned & (1u << page)) {
+            page++;
+            continue;
+        }
+        int runLength = 1;
+        while (page + runLength < fs->sb->numFBlocks &&
+            !(loaded & (1u << (page + runLength))) && !(fs->fatScanned & (1u << (page + runLength)))) {
+            runLength++;
+        }
+        if (block_read_range_ex(fs->disk, 1 + page, runLength, fs->fat + FAT_ENTRIES_PER_BLOCK * page) == 0) {
+            __atomic_or_fetch(&fs->fatLoaded, (uint32_t)(((1ULL << runLength) - 1) << page), __ATOMIC_RELEASE);
+        }
+        page += runLength;
     }
-    root->files[freeEntryIndex].firstIndex = freeFATIndex;
+    pthread_mutex_unlock(&fs->fatLoadLock);
 
-    //return 0 if successfully created file
-    return 0;
+    for (page = 0; page < fs->sb->numFBlocks; page++) {
+        fs_scanFat(fs, page);
+    }
 }
 
-int fs_delete(const char *filename)
+//returns the number of free data blocks, scanned or not
+static int fs_freeCount(fs_t *fs)
 {
-	/*FILENAME CHECKING*/
-    //check if filename is valid
-    if (filename == NULL) {
-        return -1;
-    }
+    return freemap_count(fs->freeMap) + fs->hintedFree;
+}
 
-    /*FINDING FILE WITH THE FILENAME*/
-    //check if filename exists
-    char *tempname;
-    int fileIndex = -1;
-    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
-        tempname = (char*)root->files[i].filename;
-        if(strcmp(filename, tempname) == 0) {
-            fileIndex = i;
-            break;
-        }
+//releases what a file system holds, and closes its disk
+static void fs_free(fs_t *fs)
+{
+    cache_destroy(fs->cache);
+    freemap_destroy(fs->freeMap);
+    counters_destroy(fs->stats);
+    if (!fs->metaMapped) {
+        free(fs->sb);
+        free(fs->fat);
+        free(fs->root);
     }
-    //if filename doesn't exist, return -1
-    if (fileIndex == -1) {
-        return -1;
+    free(fs->journalBuf);
+    if (fs->disk != NULL) {
+        block_disk_close_ex(fs->disk);
     }
+    pthread_mutex_destroy(&fs->fatLoadLock);
+    free(fs);
+}
 
-    /*CHECK IF FILE IS OPEN*/
-    //cycle through and check opened file descriptors
-    for (int i = 0; i < MAX_OPEN_FILE_DESCRIPTORS; i++) {
-        tempname = (char*)openedFiles[i].filename;
-        if(strcmp(filename, tempname) == 0) {
+/*META-INFORMATION WRITE-BACK*/
+//writes the FAT blocks changed since they were last written back to disk,
+//consecutive ones in a single request. fatLock must be held
+static int fs_writeFat(fs_t *fs)
+{
+    int i = 0;
+    while (i < fs->sb->numFBlocks) {
+        if (!fs->fatDirty[i]) {
+            i++;
+            continue;
+        }
+        if (fs_dropHints(fs) == -1) {
+            return -1;
+        }
+        int runLength = 1;
+        while (i + runLength < fs->sb->numFBlocks && fs->fatDirty[i + runLength]) {
+            runLength++;
+        }
+        if (block_write_range_ex(fs->disk, 1 + i, runLength, fs->fat + FAT_ENTRIES_PER_BLOCK * i) == -1) {
             return -1;
         }
+        memset(&fs->fatDirty[i], 0, runLength * sizeof(bool));
+        memset(&fs->fatUnlogged[i * FAT_ENTRIES_PER_BLOCK / 64], 0, runLength * FAT_ENTRIES_PER_BLOCK / 8);
+        i += runLength;
     }
+    return 0;
+}
 
-    /*DELETE FILE*/
-    //remove data from FAT
-    uint16_t tempFATIndex = root->files[fileIndex].firstIndex;
-    uint16_t temp;
-    while (tempFATIndex != 0xFFFF) {
-        temp = tempFATIndex;
-        tempFATIndex = fat[tempFATIndex];
-        fat[temp] = 0;
+//writes the root directory back to disk if it changed. dirLock must be held for
+//writing
+static int fs_writeRoot(fs_t *fs)
+{
+    if (fs->rootDirty) {
+        if (block_write_ex(fs->disk, fs->sb->rootIndex, fs->root) == -1) {
+            return -1;
+        }
+        fs->rootDirty = false;
+        memset(fs->rootUnlogged, 0, sizeof(fs->rootUnlogged));
     }
-    //remove data from root directory
-    root->files[fileIndex].filename[0] = '\0';
-
-    //return 0 if successfully deleted file
     return 0;
 }
 
-int fs_printFileBlocks() 
+//writes the meta-information blocks changed since the last call back to disk.
+//the superblock is only written for its free-space hints. dirLock must be held
+//for writing
+static int fs_writeMeta(fs_t *fs)
 {
-    //check if a virtual disk was opened
-    if (sb == NULL) {
+    //meta-information modified in place is already in the mapping
+    if (fs->metaMapped) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&fs->fatLock);
+    int ret = fs_writeFat(fs);
+    pthread_mutex_unlock(&fs->fatLock);
+    if (ret == -1) {
         return -1;
     }
+    return fs_writeRoot(fs);
+}
 
-    /*PRINTING*/
-    //print first line prompt
-    printf("FS Ls w/ blocks:\n");
-    //for loop to print details of each file
-    char *tempname;
-    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
-        if ((root->files[i].filename[0]) != '\0') {
-            tempname = (char*)root->files[i].filename;
-            printf("file: %s, size: %d, data_blk: %d\n", tempname, 
-                root->files[i].size, root->files[i].firstIndex);
-            uint16_t index = fat[root->files[i].firstIndex];
-            int i = 2;
-            while (index != 0xFFFF) {
-                fprintf(stderr, "\tBlock[%d]=%d\n", i, index);
-                index = fat[index];
-                ++i;
-            }
-        }
+/*JOURNAL*/
+//the journal holds the transactions committed since the FAT and root directory
+//were last written back (checkpointed), one after the other from its first
+//block. each one logs the entries changed since the previous one, so replaying
+//them all in order over the meta-information on disk gives the state of the
+//last one. a checkpoint only happens right after a transaction, while no entry
+//can change, so that replaying over a partly written checkpoint gives the same
+//state. the superblock then moves the start of the replay to the next sequence
+//number, and the journal starts over
+
+//hashes length bytes of data (FNV-1a), continuing from hash
+static uint32_t fs_checksum(uint32_t hash, const void *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ ((const uint8_t*)data)[i]) * 16777619u;
     }
+    return hash;
+}
 
-    //return 0 if listed files
-    return 0;   
+//returns the number of journal blocks of the largest transaction, logging
+//every FAT block whole and every root directory entry
+static int fs_journalReserve(fs_t *fs)
+{
+    size_t bytes = sizeof(struct journalHeader) +
+        fs->sb->numFBlocks * (5 + BLOCK_BYTES) + NUM_ROOTDIR_ENTRIES * (2 + sizeof(struct fileInfo));
+    return (bytes + BLOCK_BYTES - 1) / BLOCK_BYTES;
 }
 
-int fs_ls(void)
+//appends a FAT record of count entries from first to buf, and returns its size
+static size_t fs_logFat(fs_t *fs, char *buf, uint16_t first, uint16_t count)
 {
-	//check if a virtual disk was opened
-    if (sb == NULL) {
-        return -1;
+    buf[0] = JOURNAL_FAT;
+    memcpy(buf + 1, &first, 2);
+    memcpy(buf + 3, &count, 2);
+    memcpy(buf + 5, &fs->fat[first], 2 * count);
+    return 5 + 2 * count;
+}
+
+//returns whether FAT entry index changed since it was last logged
+static bool fs_isUnlogged(fs_t *fs, int index)
+{
+    return fs->fatUnlogged[index / 64] & (1ULL << (index % 64));
+}
+
+//logs the entries changed since they were last logged or written to disk as a
+//transaction, written to the journal in a single request. returns 1 if nothing
+//changed. dirLock must be held for writing and fatLock held
+static int fs_logChanges(fs_t *fs)
+{
+    char *buf = fs->journalBuf;
+    size_t length = sizeof(struct journalHeader);
+
+    //FAT entries, in runs of consecutive ones. a FAT block with scattered
+    //changes is logged whole when that is shorter
+    for (int page = 0; page < fs->sb->numFBlocks; page++) {
+        int first = page * FAT_ENTRIES_PER_BLOCK;
+        int last = first + FAT_ENTRIES_PER_BLOCK < fs->sb->numDBlocks ?
+            first + FAT_ENTRIES_PER_BLOCK : fs->sb->numDBlocks;
+        size_t pageStart = length;
+        int i = first;
+        while (i < last) {
+            uint64_t word = fs->fatUnlogged[i / 64] >> (i % 64);
+            if (word == 0) {
+                i = (i / 64 + 1) * 64;
+                continue;
+            }
+            i += __builtin_ctzll(word);
+            if (i >= last) {
+                break;
+            }
+            int count = 1;
+            while (i + count < last && fs_isUnlogged(fs, i + count)) {
+                count++;
+            }
+            if (length + 5 + 2 * count > pageStart + 5 + 2 * (last - first)) {
+                length = pageStart + fs_logFat(fs, buf + pageStart, first, last - first);
+                break;
+            }
+            length += fs_logFat(fs, buf + length, i, count);
+            i += count;
+        }
     }
 
-    /*PRINTING*/
-    //print first line prompt
-    printf("FS Ls:\n");
-    //for loop to print details of each file
-    char *tempname;
+    //root directory entries
     for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
-        if ((root->files[i].filename[0]) != '\0') {
-            tempname = (char*)root->files[i].filename;
-            printf("file: %s, size: %d, data_blk: %d\n", tempname, 
-                root->files[i].size, root->files[i].firstIndex);
+        if (fs->rootUnlogged[i / 64] & (1ULL << (i % 64))) {
+            buf[length] = JOURNAL_ENTRY;
+            buf[length + 1] = i;
+            memcpy(buf + length + 2, &fs->root->files[i], sizeof(struct fileInfo));
+            length += 2 + sizeof(struct fileInfo);
         }
     }
+    if (length == sizeof(struct journalHeader)) {
+        return 1;
+    }
 
-    if (FS_DEBUG) fs_printFileBlocks();
-    //return 0 if listed files
+    //the journal has room for the largest transaction, unless the last
+    //checkpoint failed
+    int blocks = (length + BLOCK_BYTES - 1) / BLOCK_BYTES;
+    if (fs->journalHead + blocks > fs->sb->journalBlocks) {
+        return -1;
+    }
+    struct journalHeader *header = (struct journalHeader*)buf;
+    header->magic = JOURNAL_MAGIC;
+    header->seq = fs->journalSeq;
+    header->length = length - sizeof(struct journalHeader);
+    header->checksum = fs_checksum(fs_checksum(2166136261u, &header->seq, 8),
+        buf + sizeof(struct journalHeader), header->length);
+    memset(buf + length, 0, blocks * BLOCK_BYTES - length);
+    if (block_write_range_ex(fs->disk, fs->sb->dataIndex + fs->sb->journalStart + fs->journalHead,
+            blocks, buf) == -1) {
+        //entries stay unlogged, for the next transaction
+        return -1;
+    }
+    fs->journalHead += blocks;
+    fs->journalSeq++;
+    memset(fs->fatUnlogged, 0, sizeof(fs->fatUnlogged));
+    memset(fs->rootUnlogged, 0, sizeof(fs->rootUnlogged));
     return 0;
 }
 
-int fs_open(const char *filename)
+//writes the meta-information blocks back to disk and starts the journal over.
+//the entries must all be logged. dirLock must be held for writing and fatLock
+//held
+static int fs_checkpoint(fs_t *fs)
 {
-	/*FILENAME/MAX OPEN CHECKING*/
-    //check if filename is valid
-    if (filename == NULL) {
+    if (!fs->metaMapped && (fs_writeFat(fs) == -1 || fs_writeRoot(fs) == -1)) {
         return -1;
     }
-    //check if there are already max number of files opened
-    int numOpened = 0;
-    for (int i = 0; i < MAX_OPEN_FILE_DESCRIPTORS; i++) {
-        if (openedFiles[i].filename[0] != '\0') {
-            numOpened++;
-        }
-    }
-    //if there are max number of files opened, reteurn -1
-    if(numOpened == MAX_OPEN_FILE_DESCRIPTORS) {
+    if (block_disk_sync_ex(fs->disk) == -1) {
         return -1;
     }
-    //check if filename exists
-    char *tempname;
-    int fileIndex = -1;
-    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
-        tempname = (char*)root->files[i].filename;
-        if(strcmp(filename, tempname) == 0) {
-            fileIndex = i;
-            break;
-        }
-    }
-    //if filename doesn't exist, return -1
-    if (fileIndex == -1) {
+    //the superblock must be on disk before the first transactions are
+    //overwritten
+    fs->sb->journalSeq = fs->journalSeq;
+    if ((!fs->metaMapped && block_write_ex(fs->disk, 0, fs->sb) == -1) ||
+        block_disk_sync_ex(fs->disk) == -1) {
         return -1;
     }
-    
-    /*OPENING FILE*/
-    //search for first entry that is free in openedFiles
-    int freeEntryIndex = -1;
-    for (int i = 0; i < MAX_OPEN_FILE_DESCRIPTORS; i++) {
-        if (openedFiles[i].filename[0] == '\0') {
-            freeEntryIndex = i;
-            break;
-        }
+    fs->journalHead = 0;
+    return 0;
+}
+
+//writes the meta-information changed since the last call to disk. with a
+//journal, it is logged as a transaction, and the meta-information blocks are
+//only written back once the journal is nearly full, or if checkpoint is set.
+//the disk is not flushed after the transaction. dirLock must be held for
+//writing
+static int fs_commitMeta(fs_t *fs, bool checkpoint)
+{
+    if (!fs->journaled) {
+        return fs_writeMeta(fs);
     }
-    //make new file descriptor
-    strcpy((char*)openedFiles[freeEntryIndex].filename, filename);
-    openedFiles[freeEntryIndex].offset = 0;
 
-    //return file descriptor when file is successfully opened
-    return freeEntryIndex;
+    pthread_mutex_lock(&fs->fatLock);
+    int ret = fs_logChanges(fs);
+    if (ret != -1 && (checkpoint ||
+            fs->sb->journalBlocks - fs->journalHead < fs->journalReserve)) {
+        ret = fs_checkpoint(fs);
+    }
+    pthread_mutex_unlock(&fs->fatLock);
+    return ret == -1 ? -1 : 0;
 }
 
-int fs_close(int fd)
+//applies the records of a transaction to the meta-information. returns -1 if
+//a record is invalid
+static int fs_applyRecords(fs_t *fs, const char *records, size_t length)
 {
-	/*CHECKING IF FD IS VALID*/
+    size_t pos = 0;
+    while (pos < length) {
+        if (records[pos] == JOURNAL_FAT && pos + 5 <= length) {
+            uint16_t first, count;
+            memcpy(&first, records + pos + 1, 2);
+            memcpy(&count, records + pos + 3, 2);
+            if (pos + 5 + 2 * count > length || first + count > fs->sb->numDBlocks) {
+                return -1;
+            }
+            for (int i = 0; i < count; i++) {
+                uint16_t value;
+                memcpy(&value, records + pos + 5 + 2 * i, 2);
+                fs_setFat(fs, first + i, value);
+            }
+            pos += 5 + 2 * count;
+        } else if (records[pos] == JOURNAL_ENTRY && pos + 2 + sizeof(struct fileInfo) <= length) {
+            uint8_t fileIndex = records[pos + 1];
+            if (fileIndex >= NUM_ROOTDIR_ENTRIES) {
+                return -1;
+            }
+            memcpy(&fs->root->files[fileIndex], records + pos + 2, sizeof(struct fileInfo));
+            fs_dirtyEntry(fs, fileIndex);
+            pos += 2 + sizeof(struct fileInfo);
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//replays the transactions of the journal, up to the first one which is
+//missing, torn or from before the last checkpoint, then writes the result back
+//to disk. the FAT is loaded as records need it
+static int fs_replay(fs_t *fs)
+{
+    char *buf = fs->journalBuf;
+    struct journalHeader *header = (struct journalHeader*)buf;
+    size_t first = fs->sb->dataIndex + fs->sb->journalStart;
+    int pos = 0;
+    fs->journalSeq = fs->sb->journalSeq;
+    while (pos < fs->sb->journalBlocks) {
+        if (block_read_ex(fs->disk, first + pos, buf) == -1) {
+            return -1;
+        }
+        //no transaction is larger than the buffer
+        size_t space = (fs->sb->journalBlocks - pos) * BLOCK_BYTES;
+        if (space > (size_t)fs->journalReserve * BLOCK_BYTES) {
+            space = fs->journalReserve * BLOCK_BYTES;
+        }
+        space -= sizeof(struct journalHeader);
+        if (header->magic != JOURNAL_MAGIC || header->seq != fs->journalSeq ||
+            header->length > space) {
+            break;
+        }
+        int blocks = (sizeof(struct journalHeader) + header->length + BLOCK_BYTES - 1) / BLOCK_BYTES;
+        if (blocks > 1 && block_read_range_ex(fs->disk, first + pos + 1, blocks - 1, buf + BLOCK_BYTES) == -1) {
+            return -1;
+        }
+        if (header->checksum != fs_checksum(fs_checksum(2166136261u, &header->seq, 8),
+                buf + sizeof(struct journalHeader), header->length)) {
+            break;
+        }
+        if (fs_applyRecords(fs, buf + sizeof(struct journalHeader), header->length) == -1) {
+            return -1;
+        }
+        pos += blocks;
+        fs->journalSeq++;
+    }
+    fs->journalHead = pos;
+    if (pos == 0) {
+        return 0;
+    }
+    memset(fs->fatUnlogged, 0, sizeof(fs->fatUnlogged));
+    memset(fs->rootUnlogged, 0, sizeof(fs->rootUnlogged));
+    return fs_checkpoint(fs);
+}
+
+//sets blocks data blocks aside for a journal, at the end of a tight free run
+//holding them, so that files can still grow into the rest of the run. the
+//FAT chains them so that they are not free for other tools either
+static int fs_createJournal(fs_t *fs, size_t blocks)
+{
+    if (blocks < 2 * (size_t)fs->journalReserve) {
+        blocks = 2 * fs->journalReserve;
+    }
+    size_t runLength;
+    fs_scanAll(fs);
+    long start = freemap_best_run(fs->freeMap, blocks, &runLength);
+    if (start == -1 || runLength < blocks) {
+        return -1;
+    }
+    start += runLength - blocks;
+    for (size_t i = 0; i < blocks; i++) {
+        freemap_set_used(fs->freeMap, start + i);
+        fs_setFat(fs, start + i, i == blocks - 1 ? 0xFFFF : start + i + 1);
+    }
+    //a stale transaction cannot look like the first one
+    char *zero = fs->journalBuf;
+    memset(zero, 0, BLOCK_BYTES);
+    if (fs_writeFat(fs) == -1 ||
+        block_write_ex(fs->disk, fs->sb->dataIndex + start, zero) == -1 ||
+        block_disk_sync_ex(fs->disk) == -1) {
+        return -1;
+    }
+    fs->sb->journalMagic = JOURNAL_MAGIC;
+    fs->sb->journalStart = start;
+    fs->sb->journalBlocks = blocks;
+    fs->sb->journalSeq = 1;
+    if (block_write_ex(fs->disk, 0, fs->sb) == -1 || block_disk_sync_ex(fs->disk) == -1) {
+        return -1;
+    }
+    fs->journalHead = 0;
+    fs->journalSeq = 1;
+    return 0;
+}
+
+//mounts the passed file system
+static fs_t *fs_load(const char *diskname, const struct fs_options *opts)
+{
+    //use default options if none were given
+    struct fs_options defaults = { .cache_blocks = FS_CACHE_BLOCKS,
+        .disk_mode = BLOCK_DISK_FILE };
+    if (opts == NULL) {
+        opts = &defaults;
+    }
+
+    fs_t *fs = calloc(1, sizeof(fs_t));
+    if (fs == NULL) {
+        return NULL;
+    }
+    fs->stats = counters_create(NUM_STATS);
+    if (fs->stats == NULL) {
+        free(fs);
+        return NULL;
+    }
+    pthread_mutex_init(&fs->fatLoadLock, NULL);
+
+    //check if disk can be opened
+    fs->disk = block_disk_open_ex(diskname, opts->disk_mode);
+    if (fs->disk == NULL) {
+        goto err;
+    }
+    fs->metaMapped = opts->disk_mode == BLOCK_DISK_MMAP;
+
+	//if disk is successfully opened, then intialize meta-information
+    /*SUPERBLOCK*/
+    if (fs->metaMapped) {
+        //superblock is used in place
+        fs->sb = block_ptr_ex(fs->disk, 0);
+    } else {
+        fs->sb = (struct superBlock*)malloc(sizeof(struct superBlock));
+        //check if superblock can be read
+        if (block_read_ex(fs->disk, 0, fs->sb) == -1) {
+            goto err;
+        }
+    }
+    //checking signature
+    for (int i = 0; SIGNATURE_CHECK[i] != '\0'; i++) { 
+        if ((char)(fs->sb->signature[i]) != SIGNATURE_CHECK[i]) {
+            goto err;
+        }
+    }
+    //checking total amount of blocks of virtual disk
+    if (fs->sb->numBlocks != block_disk_count_ex(fs->disk)) {
+        goto err;
+    }
+    //checking if numFBlocks is correct
+    int expectedFB = (fs->sb->numDBlocks * 2) / 4096;
+    if ((fs->sb->numDBlocks * 2) % 4096 > 0) {
+        expectedFB++;
+    }
+    if (fs->sb->numFBlocks != expectedFB) {
+        goto err;
+    }
+    //checking if rootIndex is correct
+    if (fs->sb->rootIndex != 1 + fs->sb->numFBlocks) {
+        goto err;
+    }
+    //checking if rootIndex is correct
+    if (fs->sb->dataIndex != 1 + fs->sb->rootIndex) {
+        goto err;
+    }
+    //checking if numDBlocks is correct
+    if (fs->sb->numDBlocks != fs->sb->numBlocks - fs->sb->dataIndex) {
+        goto err;
+    }
+    
+    /*FILE ALLOCATION TABLE*/
+    if (fs->metaMapped) {
+        //FAT blocks follow each other in the mapping
+        fs->fat = block_ptr_ex(fs->disk, 1);
+        fs->fatLoaded = (uint32_t)((1ULL << fs->sb->numFBlocks) - 1);
+    } else {
+        //FAT blocks are read on first access
+        fs->fat = (uint16_t*)malloc(sizeof(struct superBlock) * fs->sb->numFBlocks);
+        if (fs->fat == NULL) {
+            goto err;
+        }
+        fs->fatLoaded = 0;
+    }
+
+    //everything on disk is up to date
+    memset(fs->fatDirty, 0, sizeof(fs->fatDirty));
+    fs->rootDirty = false;
+
+    /*ROOT DIRECTORY*/
+    if (fs->metaMapped) {
+        fs->root = block_ptr_ex(fs->disk, fs->sb->rootIndex);
+    } else {
+        fs->root = (struct rootDirectory*)malloc(sizeof(struct rootDirectory));
+        //check if root directory can be read
+        if (block_read_ex(fs->disk, fs->sb->rootIndex, fs->root) == -1) {
+            goto err;
+        }
+    }
+
+    /*JOURNAL*/
+    //transactions committed since the last checkpoint are applied before
+    //anything is built from the meta-information. changes to the FAT
+    //invalidate the free-space hints
+    fs->hintOnDisk = fs->sb->hintMagic == HINT_MAGIC;
+    fs->journalReserve = fs_journalReserve(fs);
+    bool hasJournal = fs->sb->journalMagic == JOURNAL_MAGIC;
+    if (hasJournal && (fs->sb->journalStart == 0 ||
+        fs->sb->journalBlocks < 2 * fs->journalReserve ||
+        fs->sb->journalStart + fs->sb->journalBlocks > fs->sb->numDBlocks)) {
+        goto err;
+    }
+    if (hasJournal || (!fs->metaMapped && opts->journal_blocks > 0)) {
+        fs->journalBuf = malloc(fs->journalReserve * BLOCK_BYTES);
+        if (fs->journalBuf == NULL) {
+            goto err;
+        }
+    }
+    if (hasJournal && fs_replay(fs) == -1) {
+        goto err;
+    }
+
+    /*NAME INDEX*/
+    //every file of the root directory is hashed once here
+    memset(fs->nameIndex, -1, sizeof(fs->nameIndex));
+    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
+        if (fs->root->files[i].filename[0] != '\0') {
+            fs_indexInsert(fs, i);
+        }
+    }
+
+    /*FREE-SPACE INDEX*/
+    //FAT blocks are added to it when allocations first need them, then it is
+    //updated on every allocation and release. meanwhile, the free blocks of
+    //each FAT block come from the hints left in the superblock by the last
+    //unmount. without valid hints, every FAT block is added here
+    fs->freeMap = freemap_create(fs->sb->numDBlocks);
+    if (fs->freeMap == NULL) {
+        goto err;
+    }
+    fs->fatScanned = 0;
+    fs->hintedFree = 0;
+    for (int i = 0; i < fs->sb->numFBlocks && fs->hintOnDisk; i++) {
+        int entries = fs->sb->numDBlocks - i * FAT_ENTRIES_PER_BLOCK;
+        if (fs->sb->freeHint[i] > entries || fs->sb->freeHint[i] > FAT_ENTRIES_PER_BLOCK) {
+            fs->hintOnDisk = false;
+        }
+        fs->freeHint[i] = fs->sb->freeHint[i];
+        fs->hintedFree += fs->freeHint[i];
+        //a full FAT block has nothing to add
+        if (fs->freeHint[i] == 0) {
+            fs->fatScanned |= 1u << i;
+        }
+    }
+    if (!fs->hintOnDisk) {
+        memset(fs->freeHint, 0, sizeof(fs->freeHint));
+        fs->fatScanned = 0;
+        fs->hintedFree = 0;
+        fs_scanAll(fs);
+        if (fs->fatScanned != (uint32_t)((1ULL << fs->sb->numFBlocks) - 1)) {
+            goto err;
+        }
+    }
+
+    //a journal is made once, then used by every mount. when meta-information
+    //is accessed in place, it is only replayed, since the mapping may reach
+    //the disk at any time anyway
+    if (!hasJournal && !fs->metaMapped && opts->journal_blocks > 0 &&
+        fs_createJournal(fs, opts->journal_blocks) == -1) {
+        goto err;
+    }
+    fs->journaled = !fs->metaMapped && fs->sb->journalMagic == JOURNAL_MAGIC;
+
+    /*BLOCK CACHE*/
+    //data blocks are accessed through the cache, except when the disk is
+    //mapped since reading from the mapping is already a memory copy
+    fs->cache = cache_create(fs->disk, fs->metaMapped ? 0 : opts->cache_blocks);
+    if (fs->cache == NULL) {
+        goto err;
+    }
+    fs->delayedAlloc = opts->delayed_alloc;
+    fs->reservedBlocks = 0;
+    fs->defragFile = -1;
+    fs->readaheadMax = fs->metaMapped ? 0 : opts->cache_blocks / 2;
+    if (fs->readaheadMax > READAHEAD_MAX_BLOCKS) {
+        fs->readaheadMax = READAHEAD_MAX_BLOCKS;
+    }
+
+    /*LOCKS*/
+    pthread_rwlock_init(&fs->dirLock, NULL);
+    pthread_mutex_init(&fs->fatLock, NULL);
+    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
+        pthread_rwlock_init(&fs->fileLocks[i], NULL);
+    }
+    pthread_mutex_init(&fs->mapLock, NULL);
+    pthread_mutex_init(&fs->defragLock, NULL);
+    pthread_mutex_init(&fs->syncLock, NULL);
+    pthread_cond_init(&fs->syncDone, NULL);
+
+    //return the file system if successfully mounted
+    return fs;
+
+err:
+    fs_free(fs);
+    return NULL;
+}
+
+fs_t *fs_mount_ex(const char *diskname, const struct fs_options *opts)
+{
+    //a failed mount leaves no file system to count it in
+    uint64_t start = fs_now();
+    fs_t *fs = fs_load(diskname, opts);
+    fs_recordOp(fs, FS_OP_MOUNT, start, 0);
+    return fs;
+}
+
+//records the free blocks of each FAT block in the superblock and writes it,
+//for the next mount. the FAT on disk must be up to date
+static int fs_writeHints(fs_t *fs)
+{
+    for (int i = 0; i < fs->sb->numFBlocks; i++) {
+        int first = i * FAT_ENTRIES_PER_BLOCK;
+        if (fs->fatScanned & (1u << i)) {
+            fs->sb->freeHint[i] = freemap_count_range(fs->freeMap, first, FAT_ENTRIES_PER_BLOCK);
+        } else {
+            fs->sb->freeHint[i] = fs->freeHint[i];
+        }
+    }
+    fs->sb->hintMagic = HINT_MAGIC;
+    if (!fs->metaMapped && block_write_ex(fs->disk, 0, fs->sb) == -1) {
+        return -1;
+    }
+    fs->hintOnDisk = true;
+    return 0;
+}
+
+int fs_umount_ex(fs_t *fs)
+{
+    //check if a virtual disk was opened
+    if (fs == NULL) {
+        return -1;
+    }
+    //descriptors refer to the mounted file system, so they must be closed
+    for (int i = 0; i < MAX_OPEN_FILE_DESCRIPTORS; i++) {
+        if (fs->openedFiles[i].opened) {
+            return -1;
+        }
+    }
+
+    /*WRITING BACK TO DISK*/
+    //data blocks go first so that metadata never points to stale data
+    if (cache_flush(fs->cache) == -1) {
+        return -1;
+    }
+    if (fs_commitMeta(fs, true) == -1) {
+        return -1;
+    }
+    //the next mount doesn't need to scan the FAT
+    if (fs_writeHints(fs) == -1) {
+        return -1;
+    }
+        
+    /*FREEING VARIABLES*/
+    pthread_rwlock_destroy(&fs->dirLock);
+    pthread_mutex_destroy(&fs->fatLock);
+    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
+        pthread_rwlock_destroy(&fs->fileLocks[i]);
+    }
+    pthread_mutex_destroy(&fs->mapLock);
+    pthread_mutex_destroy(&fs->defragLock);
+    pthread_mutex_destroy(&fs->syncLock);
+    pthread_cond_destroy(&fs->syncDone);
+
+    //close disk
+    fs_free(fs);
+
+    //return 0 if successfully unmounted
+    return 0;
+}
+
+//writes everything changed so far to disk and flushes it
+static int fs_syncAll(fs_t *fs)
+{
+    //write delayed writes to the cache, then dirty data blocks, then
+    //metadata, then make it all durable. the data must be durable before the
+    //metadata pointing to it, which the disk may otherwise write first
+    for (int i = 0; i < MAX_OPEN_FILE_DESCRIPTORS; i++) {
+        pthread_rwlock_rdlock(&fs->dirLock);
+        int fileIndex = fs->openedFiles[i].opened ? fs->openedFiles[i].fileIndex : -1;
+        pthread_rwlock_unlock(&fs->dirLock);
+        if (fileIndex == -1) {
+            continue;
+        }
+        //the descriptor may have been closed in between, which flushed it
+        pthread_rwlock_wrlock(&fs->fileLocks[fileIndex]);
+        int ret = 0;
+        if (fs->openedFiles[i].opened && fs->openedFiles[i].fileIndex == fileIndex) {
+            ret = fs_flushBuffer(fs, i);
+        }
+        pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+    if (cache_flush(fs->cache) == -1 || block_disk_sync_ex(fs->disk) == -1) {
+        return -1;
+    }
+    pthread_rwlock_wrlock(&fs->dirLock);
+    int ret = fs_commitMeta(fs, false);
+    pthread_rwlock_unlock(&fs->dirLock);
+    if (ret == -1) {
+        return -1;
+    }
+    return block_disk_sync_ex(fs->disk);
+}
+
+int fs_sync_ex(fs_t *fs)
+{
+    //check if a virtual disk was opened
+    if (fs == NULL) {
+        return -1;
+    }
+
+    //a sync arriving while another one runs may have changes the running one
+    //misses, so it waits. the next sync then covers every sync which arrived
+    //until it started, and they all return its result
+    pthread_mutex_lock(&fs->syncLock);
+    uint64_t ticket = ++fs->syncArrived;
+    while (fs->syncRunning) {
+        pthread_cond_wait(&fs->syncDone, &fs->syncLock);
+    }
+    if (fs->syncCovered >= ticket) {
+        int ret = fs->syncResult;
+        pthread_mutex_unlock(&fs->syncLock);
+        return ret;
+    }
+    fs->syncRunning = true;
+    uint64_t covered = fs->syncArrived;
+    pthread_mutex_unlock(&fs->syncLock);
+
+    int ret = fs_syncAll(fs);
+
+    pthread_mutex_lock(&fs->syncLock);
+    fs->syncRunning = false;
+    fs->syncCovered = covered;
+    fs->syncResult = ret;
+    pthread_cond_broadcast(&fs->syncDone);
+    pthread_mutex_unlock(&fs->syncLock);
+    return ret;
+}
+
+int fs_cache_stats_ex(fs_t *fs, struct fs_cache_stats *stats)
+{
+    //check if a virtual disk was opened
+    if (fs == NULL || stats == NULL) {
+        return -1;
+    }
+
+    struct cache_stats cs;
+    cache_get_stats(fs->cache, &cs);
+    stats->hits = cs.hits;
+    stats->misses = cs.misses;
+    stats->evictions = cs.evictions;
+    stats->writebacks = cs.writebacks;
+    stats->prefetches = cs.prefetches;
+    stats->prefetch_hits = cs.prefetch_hits;
+
+    return 0;
+}
+
+int fs_info_ex(fs_t *fs)
+{
+	//check if a virtual disk was opened
+    if (fs == NULL) {
+        return -1;
+    }
+
+    //printing basic info
+    printf("FS Info:\n");
+    printf("total_blk_count=%d\n", fs->sb->numBlocks);
+    printf("fat_blk_count=%d\n", fs->sb->numFBlocks);
+    printf("rdir_blk=%d\n", fs->sb->rootIndex);
+    printf("data_blk=%d\n", fs->sb->dataIndex);
+    printf("data_blk_count=%d\n", fs->sb->numDBlocks);
+
+    //fat free ratio is kept by the free-space index
+    pthread_mutex_lock(&fs->fatLock);
+    int freeFat = fs_freeCount(fs);
+    pthread_mutex_unlock(&fs->fatLock);
+    printf("fat_free_ratio=%d/%d\n", freeFat, fs->sb->numDBlocks);
+
+    //calculate rdir free ratio
+    //set variable as max possible. cycle through and decrement for each empty fd
+    int freeFd = 0;
+    pthread_rwlock_rdlock(&fs->dirLock);
+    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
+        if ((fs->root->files[i].filename[0]) == '\0') {
+            freeFd++;
+        }
+    }
+    pthread_rwlock_unlock(&fs->dirLock);
+    fs_countEntries(fs, NUM_ROOTDIR_ENTRIES);
+    printf("rdir_free_ratio=%d/%d\n", freeFd, NUM_ROOTDIR_ENTRIES);
+
+    //return 0 if info has been successfully printed
+    return 0;
+}
+
+//returns the first free data block at or after from, or -1 if there is none.
+//FAT blocks are added to the free-space index in order until one holds it
+static long fs_findFree(fs_t *fs, int from)
+{
+    for (int page = from / FAT_ENTRIES_PER_BLOCK; page < fs->sb->numFBlocks; page++) {
+        fs_scanFat(fs, page);
+        long index = freemap_find(fs->freeMap, from);
+        if (index != -1 && index < (page + 1) * FAT_ENTRIES_PER_BLOCK) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+//allocates the first free data block at or after from (wrapping around), and
+//marks it as the end of a chain. returns -1 if there are no free blocks.
+//fatLock must be held, as for the other allocation functions
+static int fs_allocBlock(fs_t *fs, int from)
+{
+    long index = fs_findFree(fs, from);
+    if (index == -1 && from > 0) {
+        index = fs_findFree(fs, 0);
+    }
+    if (index == -1) {
+        return -1;
+    }
+    freemap_set_used(fs->freeMap, index);
+    fs_setFat(fs, index, 0xFFFF);
+    TRACE(ALLOC, index, from, 0);
+    return index;
+}
+
+//allocates a block for a chain ending at data block lastIndex that still needs
+//blocksNeeded blocks. the block after lastIndex is preferred so that the chain
+//grows in place, otherwise the chain continues at the start of a tight free
+//run holding blocksNeeded blocks (or the longest run if none does).
+//returns -1 if there are no free blocks
+static int fs_allocGoal(fs_t *fs, uint16_t lastIndex, int blocksNeeded)
+{
+    int goal = lastIndex + 1;
+    if (goal < fs->sb->numDBlocks) {
+        fs_scanFat(fs, goal / FAT_ENTRIES_PER_BLOCK);
+        if (freemap_is_free(fs->freeMap, goal)) {
+            return fs_allocBlock(fs, goal);
+        }
+    }
+    fs_scanAll(fs);
+    long runStart = freemap_best_run(fs->freeMap, blocksNeeded, NULL);
+    if (runStart == -1) {
+        return -1;
+    }
+    return fs_allocBlock(fs, runStart);
+}
+
+//returns the first block of the longest free run, or -1 if there are no free
+//blocks, and sets length to its length. FAT blocks not added to the free-space
+//index yet are only added, the one with the most free blocks first, while the
+//hints say they could hold a longer run
+static long fs_longestRun(fs_t *fs, size_t *length)
+{
+    long runStart = freemap_longest_run(fs->freeMap, length);
+    while (true) {
+        int page = -1;
+        for (int i = 0; i < fs->sb->numFBlocks; i++) {
+            if (!(fs->fatScanned & (1u << i)) && (size_t)fs->freeHint[i] > *length &&
+                (page == -1 || fs->freeHint[i] > fs->freeHint[page])) {
+                page = i;
+            }
+        }
+        if (page == -1) {
+            return runStart;
+        }
+        fs_scanFat(fs, page);
+        if (!(fs->fatScanned & (1u << page))) {
+            //the FAT block cannot be read, so its blocks cannot be allocated
+            return runStart;
+        }
+        runStart = freemap_longest_run(fs->freeMap, length);
+    }
+}
+
+//releases a data block
+static void fs_freeBlock(fs_t *fs, uint16_t index)
+{
+    fs_scanFat(fs, index / FAT_ENTRIES_PER_BLOCK);
+    fs_setFat(fs, index, 0);
+    freemap_set_free(fs->freeMap, index);
+    TRACE(FREE, index, 0, 0);
+}
+
+//returns the block map of root directory entry fileIndex, walking its FAT chain
+//to build it if this is the first access. returns NULL if memory is short. the
+//file lock must be held, and readers sharing it build the map one at a time
+static struct blockMap *fs_getMap(fs_t *fs, int fileIndex)
+{
+    struct blockMap *map = &fs->blockMaps[fileIndex];
+    if (__atomic_load_n(&map->blocks, __ATOMIC_ACQUIRE) != NULL) {
+        return map;
+    }
+    pthread_mutex_lock(&fs->mapLock);
+    if (map->blocks != NULL) {
+        pthread_mutex_unlock(&fs->mapLock);
+        return map;
+    }
+
+    //count blocks, then record them
+    int count = 0;
+    uint16_t index = fs->root->files[fileIndex].firstIndex;
+    while (index != 0xFFFF) {
+        count++;
+        index = fs_getFat(fs, index);
+    }
+    fs_countHops(fs, count);
+    uint16_t *blocks = malloc(count * sizeof(uint16_t));
+    if (blocks == NULL) {
+        pthread_mutex_unlock(&fs->mapLock);
+        return NULL;
+    }
+    map->count = 0;
+    map->capacity = count;
+    for (index = fs->root->files[fileIndex].firstIndex; index != 0xFFFF; index = fs_getFat(fs, index)) {
+        blocks[map->count++] = index;
+    }
+    fs_countHops(fs, count);
+    TRACE(CHAIN_WALK, fs->root->files[fileIndex].firstIndex, count, fileIndex);
+    //published last, for readers that don't take mapLock
+    __atomic_store_n(&map->blocks, blocks, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&fs->mapLock);
+    return map;
+}
+
+//records data block index as the new last block of the chain of fileIndex, if
+//its block map was built
+static void fs_mapAppend(fs_t *fs, int fileIndex, uint16_t index)
+{
+    struct blockMap *map = &fs->blockMaps[fileIndex];
+    if (map->blocks == NULL) {
+        return;
+    }
+    if (map->count == map->capacity) {
+        uint16_t *blocks = realloc(map->blocks, 2 * map->capacity * sizeof(uint16_t));
+        //without memory, drop the map so that it gets rebuilt later
+        if (blocks == NULL) {
+            free(map->blocks);
+            map->blocks = NULL;
+            return;
+        }
+        map->blocks = blocks;
+        map->capacity *= 2;
+    }
+    map->blocks[map->count++] = index;
+}
+
+//releases the block map of root directory entry fileIndex
+static void fs_dropMap(fs_t *fs, int fileIndex)
+{
+    free(fs->blockMaps[fileIndex].blocks);
+    fs->blockMaps[fileIndex].blocks = NULL;
+    fs->blockMaps[fileIndex].count = 0;
+    fs->blockMaps[fileIndex].capacity = 0;
+}
+
+//returns the size of a file, including its delayed writes
+static int fs_fileSize(fs_t *fs, int fileIndex)
+{
+    struct writeBuffer *wb = &fs->writeBuffers[fileIndex];
+    int size = fs->root->files[fileIndex].size;
+    if (wb->length > 0 && wb->start + wb->length > size) {
+        size = wb->start + wb->length;
+    }
+    return size;
+}
+
+//returns whether filename can be given to a file: not empty, and short enough
+//for the NULL character to fit
+static bool fs_validName(const char *filename)
+{
+    return filename != NULL && filename[0] != '\0' && strlen(filename) < FILENAME_MAX_SIZE;
+}
+
+//makes free root directory entry fileIndex an empty file named filename, whose
+//only block is data block index. dirLock must be held for writing
+static void fs_newEntry(fs_t *fs, int fileIndex, const char *filename, uint16_t index)
+{
+    strcpy((char*)fs->root->files[fileIndex].filename, filename);
+    fs->root->files[fileIndex].size = 0;
+    fs->root->files[fileIndex].firstIndex = index;
+    fs_dirtyEntry(fs, fileIndex);
+    fs_indexInsert(fs, fileIndex);
+}
+
+//releases the data blocks of the chain starting at data block index, and
+//returns their number. fatLock must be held
+static size_t fs_freeChain(fs_t *fs, uint16_t index)
+{
+    size_t hops = 0;
+    while (index != 0xFFFF) {
+        uint16_t next = fs_getFat(fs, index);
+        fs_freeBlock(fs, index);
+        index = next;
+        hops++;
+    }
+    return hops;
+}
+
+//returns whether root directory entry fileIndex is opened by a descriptor, or
+//being moved by the defragmenter. dirLock must be held
+static bool fs_isOpen(fs_t *fs, int fileIndex)
+{
+    if (fileIndex == fs->defragFile) {
+        return true;
+    }
+    for (int i = 0; i < MAX_OPEN_FILE_DESCRIPTORS; i++) {
+        if (fs->openedFiles[i].opened && fs->openedFiles[i].fileIndex == fileIndex) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//releases the data blocks of root directory entry fileIndex and frees the
+//entry. dirLock must be held for writing and fatLock held
+static void fs_removeEntry(fs_t *fs, int fileIndex)
+{
+    fs_countHops(fs, fs_freeChain(fs, fs->root->files[fileIndex].firstIndex));
+    fs_indexRemove(fs, fileIndex);
+    fs->root->files[fileIndex].filename[0] = '\0';
+    fs_dirtyEntry(fs, fileIndex);
+}
+
+static int fs_createFile(fs_t *fs, const char *filename)
+{
+    /*FILENAME CHECKING*/
+    //check if a virtual disk was opened, and if filename is valid or too
+    //long (the NULL character must fit)
+    if (fs == NULL || !fs_validName(filename)) {
+        return -1;
+    }
+    //check if filename is a duplicate
+    pthread_rwlock_wrlock(&fs->dirLock);
+    if (fs_lookup(fs, filename) != -1) {
+        pthread_rwlock_unlock(&fs->dirLock);
+        return -1;
+    }
+
+    /*SEARCHING FOR OPEN ROOT DIRECTORY ENTRY*/
+    //if checks pass, then find open root directory entry
+    int freeEntryIndex = -1;
+    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
+        if ((fs->root->files[i].filename[0]) == '\0') {
+            freeEntryIndex = i;
+            break;
+        }
+    }
+    fs_countEntries(fs, freeEntryIndex == -1 ? NUM_ROOTDIR_ENTRIES : freeEntryIndex + 1);
+    //if no entries were open, then return -1
+    if (freeEntryIndex == -1) {
+        pthread_rwlock_unlock(&fs->dirLock);
+        return -1;
+    }
+
+
+
+    /*MANAGING INFO IN NEW ENTRY*/
+    //the first block goes in the middle of the largest free run, so that both
+    //the file before the run and the new file have room to grow in place. a
+    //run at the start of the data blocks has no file before it. blocks
+    //reserved for delayed writes are not free for new files
+    size_t runLength;
+    long runStart = -1;
+    pthread_mutex_lock(&fs->fatLock);
+    if (fs_freeCount(fs) - fs->reservedBlocks >= 1) {
+        runStart = fs_longestRun(fs, &runLength);
+    }
+    if (runStart > 1) {
+        runStart += runLength / 2;
+    }
+    int freeFATIndex = runStart == -1 ? -1 : fs_allocBlock(fs, runStart);
+    pthread_mutex_unlock(&fs->fatLock);
+    //if no space in FAT is open
+    if (freeFATIndex == -1) {
+        pthread_rwlock_unlock(&fs->dirLock);
+        return -1;
+    }
+
+    //updating filename and size for new entry
+    fs_newEntry(fs, freeEntryIndex, filename, freeFATIndex);
+    pthread_rwlock_unlock(&fs->dirLock);
+
+    //return 0 if successfully created file
+    return 0;
+}
+
+int fs_create_ex(fs_t *fs, const char *filename)
+{
+    uint64_t start = fs_now();
+    int ret = fs_createFile(fs, filename);
+    fs_recordOp(fs, FS_OP_CREATE, start, ret);
+    return ret;
+}
+
+static int fs_deleteFile(fs_t *fs, const char *filename)
+{
+	/*FILENAME CHECKING*/
+    //check if a virtual disk was opened and if filename is valid
+    if (fs == NULL || filename == NULL) {
+        return -1;
+    }
+
+    /*FINDING FILE WITH THE FILENAME*/
+    //check if filename exists
+    pthread_rwlock_wrlock(&fs->dirLock);
+    int fileIndex = fs_lookup(fs, filename);
+    //if filename doesn't exist, return -1
+    if (fileIndex == -1) {
+        pthread_rwlock_unlock(&fs->dirLock);
+        return -1;
+    }
+
+    /*CHECK IF FILE IS OPEN*/
+    //cycle through and check opened file descriptors
+    if (fs_isOpen(fs, fileIndex)) {
+        pthread_rwlock_unlock(&fs->dirLock);
+        return -1;
+    }
+
+    /*DELETE FILE*/
+    //remove data from FAT, then from root directory
+    pthread_mutex_lock(&fs->fatLock);
+    fs_removeEntry(fs, fileIndex);
+    pthread_mutex_unlock(&fs->fatLock);
+    pthread_rwlock_unlock(&fs->dirLock);
+
+    //return 0 if successfully deleted file
+    return 0;
+}
+
+int fs_delete_ex(fs_t *fs, const char *filename)
+{
+    uint64_t start = fs_now();
+    int ret = fs_deleteFile(fs, filename);
+    fs_recordOp(fs, FS_OP_DELETE, start, ret);
+    return ret;
+}
+
+/*BATCHES*/
+//state of a batch: root directory entries free for its creates, one bit each,
+//and the free run over which their first blocks are spread
+struct batch {
+    uint64_t freeEntries[NUM_ROOTDIR_ENTRIES / 64];
+    long runStart;
+    size_t runLength;
+    int creates;
+    int created;
+};
+
+//creates filename as part of batch b. the k-th of n creates gets its first
+//block at k + 1 n + 1ths of the run, so that each file has room to grow in
+//place, or at k nths if the run is at the start of the data blocks. dirLock
+//must be held for writing and fatLock held, as for the other batch functions
+static int fs_batchCreate(fs_t *fs, struct batch *b, const char *filename)
+{
+    int k = b->created++;
+    if (!fs_validName(filename) || fs_lookup(fs, filename) != -1) {
+        return -1;
+    }
+    int fileIndex = -1;
+    for (int i = 0; i < NUM_ROOTDIR_ENTRIES / 64 && fileIndex == -1; i++) {
+        if (b->freeEntries[i] != 0) {
+            fileIndex = i * 64 + __builtin_ctzll(b->freeEntries[i]);
+        }
+    }
+    //blocks reserved for delayed writes are not free for new files
+    if (fileIndex == -1 || b->runStart == -1 || fs_freeCount(fs) - fs->reservedBlocks < 1) {
+        return -1;
+    }
+    long goal = b->runStart > 1 ? b->runStart + (k + 1) * b->runLength / (b->creates + 1)
+        : b->runStart + k * b->runLength / b->creates;
+    int index = fs_allocBlock(fs, goal);
+    if (index == -1) {
+        return -1;
+    }
+    fs_newEntry(fs, fileIndex, filename, index);
+    b->freeEntries[fileIndex / 64] &= ~(1ULL << (fileIndex % 64));
+    return 0;
+}
+
+static int fs_batchDelete(fs_t *fs, struct batch *b, const char *filename)
+{
+    int fileIndex = fs_lookup(fs, filename);
+    if (fileIndex == -1 || fs_isOpen(fs, fileIndex)) {
+        return -1;
+    }
+    fs_removeEntry(fs, fileIndex);
+    b->freeEntries[fileIndex / 64] |= 1ULL << (fileIndex % 64);
+    return 0;
+}
+
+static int fs_batchRename(fs_t *fs, const char *filename, const char *newname)
+{
+    int fileIndex = fs_lookup(fs, filename);
+    if (fileIndex == -1 || !fs_validName(newname) || fs_lookup(fs, newname) != -1) {
+        return -1;
+    }
+    //descriptors refer to the entry, not to the name
+    fs_indexRemove(fs, fileIndex);
+    memset(fs->root->files[fileIndex].filename, 0, FILENAME_MAX_SIZE);
+    strcpy((char*)fs->root->files[fileIndex].filename, newname);
+    fs_indexInsert(fs, fileIndex);
+    fs_dirtyEntry(fs, fileIndex);
+    return 0;
+}
+
+//shrinks filename to size bytes, releasing the blocks past the new end. the
+//file keeps its first block even when empty
+static int fs_batchTruncate(fs_t *fs, const char *filename, size_t size)
+{
+    int fileIndex = fs_lookup(fs, filename);
+    if (fileIndex == -1 || fs_isOpen(fs, fileIndex) || size > fs->root->files[fileIndex].size) {
+        return -1;
+    }
+    int keep = size == 0 ? 1 : (size + BLOCK_BYTES - 1) / BLOCK_BYTES;
+    uint16_t lastIndex = fs->root->files[fileIndex].firstIndex;
+    for (int i = 1; i < keep; i++) {
+        lastIndex = fs_getFat(fs, lastIndex);
+    }
+    fs_countHops(fs, keep - 1);
+    uint16_t next = fs_getFat(fs, lastIndex);
+    if (next != 0xFFFF) {
+        fs_setFat(fs, lastIndex, 0xFFFF);
+        fs_countHops(fs, fs_freeChain(fs, next));
+    }
+    fs->root->files[fileIndex].size = size;
+    fs_dirtyEntry(fs, fileIndex);
+    return 0;
+}
+
+static int fs_runBatch(fs_t *fs, struct fs_batch_item *items, size_t count)
+{
+    //check if a virtual disk was opened, and if there are items
+    if (fs == NULL || (items == NULL && count > 0)) {
+        return -1;
+    }
+    //data blocks changed so far must be durable before the metadata pointing
+    //to them. delayed writes of open files stay in their buffers
+    if (cache_flush(fs->cache) == -1 || block_disk_sync_ex(fs->disk) == -1) {
+        return -1;
+    }
+
+    /*PREPARING*/
+    //free root directory entries are found in one scan, and the largest free
+    //run once for all the creates
+    struct batch b = { .runStart = -1 };
+    for (size_t i = 0; i < count; i++) {
+        if (items[i].op == FS_BATCH_CREATE) {
+            b.creates++;
+        }
+    }
+    pthread_rwlock_wrlock(&fs->dirLock);
+    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
+        if (fs->root->files[i].filename[0] == '\0') {
+            b.freeEntries[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+    fs_countEntries(fs, NUM_ROOTDIR_ENTRIES);
+    pthread_mutex_lock(&fs->fatLock);
+    if (b.creates > 0) {
+        b.runStart = fs_longestRun(fs, &b.runLength);
+    }
+
+    /*RUNNING OPERATIONS*/
+    int failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct fs_batch_item *item = &items[i];
+        switch (item->op) {
+        case FS_BATCH_CREATE:
+            item->result = fs_batchCreate(fs, &b, item->filename);
+            break;
+        case FS_BATCH_DELETE:
+            item->result = fs_batchDelete(fs, &b, item->filename);
+            break;
+        case FS_BATCH_RENAME:
+            item->result = fs_batchRename(fs, item->filename, item->newname);
+            break;
+        case FS_BATCH_TRUNCATE:
+            item->result = fs_batchTruncate(fs, item->filename, item->size);
+            break;
+        default:
+            item->result = -1;
+        }
+        if (item->result == -1) {
+            failed++;
+        }
+    }
+    pthread_mutex_unlock(&fs->fatLock);
+
+    /*WRITING BACK TO DISK*/
+    //all the changes of the batch together
+    int ret = fs_commitMeta(fs, false);
+    pthread_rwlock_unlock(&fs->dirLock);
+    if (ret == -1 || block_disk_sync_ex(fs->disk) == -1) {
+        return -1;
+    }
+    return failed;
+}
+
+int fs_batch_ex(fs_t *fs, struct fs_batch_item *items, size_t count)
+{
+    uint64_t start = fs_now();
+    int ret = fs_runBatch(fs, items, count);
+    fs_recordOp(fs, FS_OP_BATCH, start, ret);
+    return ret;
+}
+
+int fs_ls_ex(fs_t *fs)
+{
+	//check if a virtual disk was opened
+    if (fs == NULL) {
+        return -1;
+    }
+
+    /*PRINTING*/
+    //print first line prompt
+    printf("FS Ls:\n");
+    //for loop to print details of each file
+    char *tempname;
+    pthread_rwlock_rdlock(&fs->dirLock);
+    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
+        if ((fs->root->files[i].filename[0]) != '\0') {
+            tempname = (char*)fs->root->files[i].filename;
+            printf("file: %s, size: %d, data_blk: %d\n", tempname, 
+                fs->root->files[i].size, fs->root->files[i].firstIndex);
+        }
+    }
+    pthread_rwlock_unlock(&fs->dirLock);
+    fs_countEntries(fs, NUM_ROOTDIR_ENTRIES);
+    //return 0 if listed files
+    return 0;
+}
+
+static int fs_openFile(fs_t *fs, const char *filename)
+{
+	/*FILENAME/MAX OPEN CHECKING*/
+    //check if a virtual disk was opened and if filename is valid
+    if (fs == NULL || filename == NULL) {
+        return -1;
+    }
+    //check if there are already max number of files opened
+    pthread_rwlock_wrlock(&fs->dirLock);
+    int numOpened = 0;
+    for (int i = 0; i < MAX_OPEN_FILE_DESCRIPTORS; i++) {
+        if (fs->openedFiles[i].opened) {
+            numOpened++;
+        }
+    }
+    //if there are max number of files opened, reteurn -1
+    if(numOpened == MAX_OPEN_FILE_DESCRIPTORS) {
+        pthread_rwlock_unlock(&fs->dirLock);
+        return -1;
+    }
+    //check if filename exists
+    int fileIndex = fs_lookup(fs, filename);
+    //if filename doesn't exist, return -1
+    if (fileIndex == -1) {
+        pthread_rwlock_unlock(&fs->dirLock);
+        return -1;
+    }
+    
+    /*OPENING FILE*/
+    //search for first entry that is free in openedFiles
+    int freeEntryIndex = -1;
+    for (int i = 0; i < MAX_OPEN_FILE_DESCRIPTORS; i++) {
+        if (!fs->openedFiles[i].opened) {
+            freeEntryIndex = i;
+            break;
+        }
+    }
+    //make new file descriptor, with its cursor on the first block
+    fs->openedFiles[freeEntryIndex].opened = true;
+    fs->openedFiles[freeEntryIndex].fileIndex = fileIndex;
+    fs->openedFiles[freeEntryIndex].offset = 0;
+    fs->openedFiles[freeEntryIndex].cursor.index = fs->root->files[fileIndex].firstIndex;
+    fs->openedFiles[freeEntryIndex].cursor.block = 0;
+    //no read yet, so reading from block 0 is sequential
+    fs->openedFiles[freeEntryIndex].raLast = -1;
+    fs->openedFiles[freeEntryIndex].raEnd = 0;
+    fs->openedFiles[freeEntryIndex].raWindow = 0;
+    fs->openedFiles[freeEntryIndex].raHits = 0;
+    fs->openedFiles[freeEntryIndex].raMisses = 0;
+    //block map is built on first access, and shared with other descriptors
+    fs->blockMaps[fileIndex].users++;
+    pthread_rwlock_unlock(&fs->dirLock);
+
+    //return file descriptor when file is successfully opened
+    return freeEntryIndex;
+}
+
+int fs_open_ex(fs_t *fs, const char *filename)
+{
+    uint64_t start = fs_now();
+    int ret = fs_openFile(fs, filename);
+    fs_recordOp(fs, FS_OP_OPEN, start, ret);
+    return ret;
+}
+
+int fs_close_ex(fs_t *fs, int fd)
+{
+	/*CHECKING IF FD IS VALID*/
+    //return -1 if fd is out of bounds
+    if (fs == NULL || fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
+        return -1;
+    }
+    //return -1 if fd is not opened
+    if (!fs->openedFiles[fd].opened) {
+        return -1;
+    }
+
+    /*CLOSING FILE */
+    //delayed writes go to disk on close
+    int fileIndex = fs->openedFiles[fd].fileIndex;
+    pthread_rwlock_wrlock(&fs->fileLocks[fileIndex]);
+    int ret = fs_flushBuffer(fs, fd);
+    //last descriptor on the file releases its block map and buffer
+    pthread_rwlock_wrlock(&fs->dirLock);
+    if (--fs->blockMaps[fileIndex].users == 0) {
+        struct writeBuffer *wb = &fs->writeBuffers[fileIndex];
+        fs_dropMap(fs, fileIndex);
+        //delayed writes that could not be written are lost with the buffer
+        if (wb->length > 0) {
+            pthread_mutex_lock(&fs->fatLock);
+            fs->reservedBlocks -= wb->reserved;
+            pthread_mutex_unlock(&fs->fatLock);
+            wb->reserved = 0;
+            wb->length = 0;
+        }
+        free(wb->data);
+        wb->data = NULL;
+    }
+    fs->openedFiles[fd].opened = false;
+    fs->openedFiles[fd].offset = 0;
+    pthread_rwlock_unlock(&fs->dirLock);
+    pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+
+    //return 0 when file is successfully closed
+    return ret;
+}
+
+int fs_readahead_stats_ex(fs_t *fs, int fd, struct fs_readahead_stats *stats)
+{
+    //return -1 if fd is out of bounds, not opened or stats is NULL
+    if (fs == NULL || fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
+        return -1;
+    }
+    if (!fs->openedFiles[fd].opened || stats == NULL) {
+        return -1;
+    }
+
+    stats->window = fs->openedFiles[fd].raWindow;
+    stats->hits = fs->openedFiles[fd].raHits;
+    stats->misses = fs->openedFiles[fd].raMisses;
+    return 0;
+}
+
+int fs_stat_ex(fs_t *fs, int fd)
+{
+	/*CHECKING IF FD IS VALID*/
+    //return -1 if fd is out of bounds
+    if (fs == NULL || fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
+        return -1;
+    }
+    //return -1 if fd is not opened
+    if (!fs->openedFiles[fd].opened) {
+        return -1;
+    }
+
+    /*GETTING SIZE*/
+    //descriptor knows its root directory entry
+    int fileIndex = fs->openedFiles[fd].fileIndex;
+    //get corresponding size and return it
+    pthread_rwlock_rdlock(&fs->fileLocks[fileIndex]);
+    int size = fs_fileSize(fs, fileIndex);
+    pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+    return size;
+}
+
+int fs_lseek_ex(fs_t *fs, int fd, size_t offset)
+{
+	/*CHECKING IF FD IS VALID*/
+    //return -1 if fd is out of bounds
+    if (fs == NULL || fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
+        return -1;
+    }
+    //return -1 if fd is not opened
+    if (!fs->openedFiles[fd].opened) {
+        return -1;
+    }
+
+    /*CHECKING IF OFFSET IS VALID*/
+    //descriptor knows its root directory entry
+    int fileIndex = fs->openedFiles[fd].fileIndex;
+    //return -1 if offset is out of bounds
+    pthread_rwlock_rdlock(&fs->fileLocks[fileIndex]);
+    int size = fs_fileSize(fs, fileIndex);
+    pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+    if (offset < 0 || offset > (size_t)size) {
+        return -1;
+    }
+
+    /*SETTING OFFSET*/
+    //set new offset
+    fs->openedFiles[fd].offset = offset;
+
+    //return 0 when offset is updated successfully 
+    return 0;
+}
+
+//returns the data block holding logical block number block of the file at
+//root directory entry fileIndex, and moves cursor there. the block map gives
+//it directly. if the map cannot be built, the walk starts from the cursor when
+//it is not past block, from the first block of the file otherwise
+static uint16_t fs_seekBlock(fs_t *fs, int fileIndex, struct chainCursor *cursor, int block)
+{
+    struct blockMap *map = fs_getMap(fs, fileIndex);
+    if (map != NULL && block < map->count) {
+        cursor->index = map->blocks[block];
+        cursor->block = block;
+        return cursor->index;
+    }
+    if (cursor->block > block) {
+        cursor->index = fs->root->files[fileIndex].firstIndex;
+        cursor->block = 0;
+    }
+    fs_countHops(fs, block - cursor->block);
+    TRACE(CHAIN_WALK, cursor->index, block - cursor->block, fileIndex);
+    while (cursor->block < block) {
+        cursor->index = fs_getFat(fs, cursor->index);
+        cursor->block++;
+    }
+    return cursor->index;
+}
+
+//walks the FAT chain from index and returns the number of contiguous blocks
+//(at most maxBlocks) starting there. index is left on the last block of the run
+static int fs_nextRun(fs_t *fs, uint16_t *index, int maxBlocks)
+{
+    int runLength = 1;
+    while (runLength < maxBlocks && fs_getFat(fs, *index) == *index + 1) {
+        *index = fs_getFat(fs, *index);
+        runLength++;
+    }
+    fs_countHops(fs, runLength - 1);
+    return runLength;
+}
+
+//returns the number of bytes of the iovcnt buffers of iov, or -1 if iovcnt is
+//invalid or if the buffers hold more bytes than can be counted
+static ssize_t fs_ioLength(const struct iovec *iov, int iovcnt)
+{
+    if (iovcnt < 0 || iovcnt > IOV_MAX || (iov == NULL && iovcnt > 0)) {
+        return -1;
+    }
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > SSIZE_MAX - total) {
+            return -1;
+        }
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+//moves the position of io count bytes forward, within its current buffer, and
+//past the buffers that are used up
+static void fs_ioAdvance(struct ioVector *io, size_t count)
+{
+    io->offset += count;
+    while (io->current < io->count && io->offset == io->iov[io->current].iov_len) {
+        io->current++;
+        io->offset = 0;
+    }
+}
+
+//starts io at the beginning of the iovcnt buffers of iov
+static void fs_ioInit(struct ioVector *io, const struct iovec *iov, int iovcnt)
+{
+    io->iov = iov;
+    io->count = iovcnt;
+    io->current = 0;
+    io->offset = 0;
+    fs_ioAdvance(io, 0);
+}
+
+//copies count bytes between buf and the buffers of io, from its position on,
+//and moves the position past them
+static void fs_ioCopy(struct ioVector *io, char *buf, size_t count, bool toVector)
+{
+    while (count > 0) {
+        const struct iovec *v = &io->iov[io->current];
+        size_t n = v->iov_len - io->offset < count ? v->iov_len - io->offset : count;
+        if (toVector) {
+            memcpy((char*)v->iov_base + io->offset, buf, n);
+        } else {
+            memcpy(buf, (char*)v->iov_base + io->offset, n);
+        }
+        buf += n;
+        count -= n;
+        fs_ioAdvance(io, n);
+    }
+}
+
+//fills vec with the pieces of the buffers of io holding its next count bytes,
+//moves the position past them, and returns the number of pieces
+static int fs_ioSpan(struct ioVector *io, size_t count, struct iovec *vec)
+{
+    int pieces = 0;
+    while (count > 0) {
+        const struct iovec *v = &io->iov[io->current];
+        size_t n = v->iov_len - io->offset < count ? v->iov_len - io->offset : count;
+        vec[pieces].iov_base = (char*)v->iov_base + io->offset;
+        vec[pieces].iov_len = n;
+        pieces++;
+        count -= n;
+        fs_ioAdvance(io, n);
+    }
+    return pieces;
+}
+
+//transfers count bytes between the buffers of io and disk block block, from
+//startOffset in the block. bytes spread over several buffers go through a
+//bounce buffer, so that the block is still accessed once
+static int fs_transferBlock(fs_t *fs, size_t block, int startOffset, int count,
+    struct ioVector *io, bool write)
+{
+    const struct iovec *v = &io->iov[io->current];
+    if (v->iov_len - io->offset >= (size_t)count) {
+        char *buf = (char*)v->iov_base + io->offset;
+        int ret = write ? cache_write(fs->cache, block, startOffset, count, buf)
+            : cache_read(fs->cache, block, startOffset, count, buf);
+        if (ret == -1) {
+            return -1;
+        }
+        fs_ioAdvance(io, count);
+        return 0;
+    }
+
+    char *bounce = block_buf_get();
+    if (bounce == NULL) {
+        return -1;
+    }
+    if (write) {
+        fs_ioCopy(io, bounce, count, false);
+    }
+    int ret = write ? cache_write(fs->cache, block, startOffset, count, bounce)
+        : cache_read(fs->cache, block, startOffset, count, bounce);
+    if (ret == 0 && !write) {
+        fs_ioCopy(io, bounce, count, true);
+    }
+    block_buf_put(bounce);
+    return ret;
+}
+
+//transfers count bytes between the buffers of io and a run of contiguous data
+//blocks starting at startOffset in data block index. whole blocks go directly
+//between the buffers and the disk as one request, however many buffers hold
+//them. only partial first and last blocks go through the cache's
+//read-modify-write
+static int fs_transferRun(fs_t *fs, uint16_t index, int startOffset, int count,
+    struct ioVector *io, bool write)
+{
+    size_t block = index + fs->sb->dataIndex;
+
+    //partial first block
+    if (startOffset > 0 || count < BLOCK_BYTES) {
+        int n = count < BLOCK_BYTES - startOffset ? count : BLOCK_BYTES - startOffset;
+        if (fs_transferBlock(fs, block, startOffset, n, io, write) == -1) {
+            return -1;
+        }
+        count -= n;
+        block++;
+    }
+
+    //whole blocks
+    int fullBlocks = count / BLOCK_BYTES;
+    if (fullBlocks > 0) {
+        struct iovec vec[io->count - io->current];
+        int pieces = fs_ioSpan(io, (size_t)fullBlocks * BLOCK_BYTES, vec);
+        int ret = write ? cache_writev(fs->cache, block, fullBlocks, vec, pieces)
+            : cache_readv(fs->cache, block, fullBlocks, vec, pieces);
+        if (ret == -1) {
+            return -1;
+        }
+        count -= fullBlocks * BLOCK_BYTES;
+        block += fullBlocks;
+    }
+
+    //partial last block
+    if (count > 0) {
+        if (fs_transferBlock(fs, block, 0, count, io, write) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//returns the last data block of the chain of the file opened as fd, and sets
+//blocks to the length of the chain. they come from the block map, or from a
+//walk from the cursor
+static uint16_t fs_chainEnd(fs_t *fs, int fd, int *blocks)
+{
+    struct fileDescriptor *desc = &fs->openedFiles[fd];
+    struct blockMap *map = fs_getMap(fs, desc->fileIndex);
+    if (map != NULL) {
+        *blocks = map->count;
+        return map->blocks[map->count - 1];
+    }
+
+    uint16_t lastIndex = fs_seekBlock(fs, desc->fileIndex, &desc->cursor, desc->cursor.block);
+    *blocks = desc->cursor.block + 1;
+    while (fs_getFat(fs, lastIndex) != 0xFFFF) {
+        lastIndex = fs_getFat(fs, lastIndex);
+        (*blocks)++;
+    }
+    fs_countHops(fs, *blocks - (desc->cursor.block + 1));
+    TRACE(CHAIN_WALK, desc->cursor.index, *blocks - (desc->cursor.block + 1), desc->fileIndex);
+    return lastIndex;
+}
+
+//appends up to blocksNeeded blocks to the chain of root directory entry
+//fileIndex, which ends at data block lastIndex. returns the number of blocks
+//appended, smaller than blocksNeeded if the disk is full. fatLock must be held
+static int fs_growChain(fs_t *fs, int fileIndex, uint16_t lastIndex, int blocksNeeded)
+{
+    //free blocks come from the free-space index instead of scanning the FAT,
+    //extending the chain in place when possible
+    int added = 0;
+    while (added < blocksNeeded) {
+        //assign new block at the end of the chain
+        int newIndex = fs_allocGoal(fs, lastIndex, blocksNeeded - added);
+        if (newIndex == -1) {
+            break;
+        }
+        added++;
+        fs_setFat(fs, lastIndex, newIndex);
+        lastIndex = newIndex;
+        fs_mapAppend(fs, fileIndex, newIndex);
+    }
+    return added;
+}
+
+//writes count bytes of the buffers of io at offset in the file opened as fd,
+//allocating the blocks it needs. returns the number of bytes written, which is
+//smaller than count if the disk is full
+static int fs_writeAt(fs_t *fs, int fd, int offset, struct ioVector *io, size_t count)
+{
+    /*FINDING FILE IN ROOT DIRECTORY*/
+    //descriptor knows its root directory entry
+    int fileIndex = fs->openedFiles[fd].fileIndex;
+
+    /*CHECKING HOW MUCH SPACE IS NEEDED*/
+    //calculate how many total blocks are needed
+    int totalBytes = offset + (int)count; 
+    int totalBlocks = totalBytes / BLOCK_BYTES;
+    if (totalBytes % BLOCK_BYTES > 0) {
+        totalBlocks++;
+    }
+
+    //calculating how many data blocks we have
+    int blocksHave;
+    uint16_t lastIndex = fs_chainEnd(fs, fd, &blocksHave);
+    //calculating how many more blocks we need, leaving the blocks reserved
+    //for delayed writes
+    int blocksNeeded = totalBlocks - blocksHave;
+
+    /*ASSIGN BLOCKS TO MEET TOTAL NUMBER OF BLOCKS*/
+    //if blocks need to be assigned, assign as many as possible
+    //(writing inside the file never frees blocks)
+    if (blocksNeeded > 0) {
+        pthread_mutex_lock(&fs->fatLock);
+        int blocksFree = fs_freeCount(fs) - fs->reservedBlocks;
+        if (blocksNeeded > blocksFree) {
+            blocksNeeded = blocksFree;
+        }
+        blocksHave += fs_growChain(fs, fileIndex, lastIndex, blocksNeeded);
+        pthread_mutex_unlock(&fs->fatLock);
+    }
+
+    //if the disk is full, only write what fits in the blocks we have
+    if (totalBytes > blocksHave * BLOCK_BYTES) {
+        count = blocksHave * BLOCK_BYTES - offset;
+        totalBytes = offset + count;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    /*SKIP TO THE BLOCK HOLDING THE OFFSET*/
+    int blockNumber = offset / BLOCK_BYTES;
+    uint16_t currentIndex = fs_seekBlock(fs, fileIndex, &fs->openedFiles[fd].cursor, blockNumber);
+
+    /*WRITE ONE RUN OF CONTIGUOUS BLOCKS AT A TIME*/
+    int startOffset = offset % BLOCK_BYTES;
+    int blocksLeft = totalBlocks - blockNumber;
+    size_t written = 0;
+
+    while (written < count) {
+        uint16_t runStart = currentIndex;
+        int runLength = fs_nextRun(fs, &currentIndex, 
+            blocksLeft < RUN_MAX_BLOCKS ? blocksLeft : RUN_MAX_BLOCKS);
+        int runBytes = runLength * BLOCK_BYTES - startOffset;
+        int copyCount = count - written < runBytes ? count - written : runBytes;
+
+        TRACE(RUN, runStart, runLength, copyCount);
+
+        if (fs_transferRun(fs, runStart, startOffset, copyCount, io, true) == -1) {
+            break;
+        }
+
+        //leave the cursor on the last block of the run
+        blockNumber += runLength;
+        fs->openedFiles[fd].cursor.index = currentIndex;
+        fs->openedFiles[fd].cursor.block = blockNumber - 1;
+
+        written += copyCount;
+        blocksLeft -= runLength;
+        startOffset = 0;
+        currentIndex = fs_getFat(fs, currentIndex);
+        fs_countHops(fs, 1);
+    }
+
+    //change size
+    if (offset + written > fs->root->files[fileIndex].size) {
+        pthread_rwlock_wrlock(&fs->dirLock);
+        fs->root->files[fileIndex].size = offset + written;
+        fs_dirtyEntry(fs, fileIndex);
+        pthread_rwlock_unlock(&fs->dirLock);
+    }
+
+    return written;
+}
+
+//writes the delayed writes of the file opened as fd to disk
+static int fs_flushBuffer(fs_t *fs, int fd)
+{
+    int fileIndex = fs->openedFiles[fd].fileIndex;
+    struct writeBuffer *wb = &fs->writeBuffers[fileIndex];
+    if (wb->length == 0) {
+        return 0;
+    }
+
+    //blocks were reserved for the buffer, so it fits on disk once they are
+    //released
+    pthread_mutex_lock(&fs->fatLock);
+    fs->reservedBlocks -= wb->reserved;
+    pthread_mutex_unlock(&fs->fatLock);
+    wb->reserved = 0;
+    struct iovec iov = { wb->data, wb->length };
+    struct ioVector io;
+    fs_ioInit(&io, &iov, 1);
+    int written = fs_writeAt(fs, fd, wb->start, &io, wb->length);
+    if (written == wb->length) {
+        wb->length = 0;
+        return 0;
+    }
+
+    //the rest stays buffered for the next flush, with the blocks it still
+    //needs past the end of the chain reserved again
+    memmove(wb->data, wb->data + written, wb->length - written);
+    wb->start += written;
+    wb->length -= written;
+    int blocksHave;
+    fs_chainEnd(fs, fd, &blocksHave);
+    int blocksNeeded = (wb->start + wb->length + BLOCK_BYTES - 1) / BLOCK_BYTES - blocksHave;
+    if (blocksNeeded > 0) {
+        pthread_mutex_lock(&fs->fatLock);
+        fs->reservedBlocks += blocksNeeded;
+        pthread_mutex_unlock(&fs->fatLock);
+        wb->reserved = blocksNeeded;
+    }
+    return -1;
+}
+
+//adds count bytes of the buffers of io at offset to the delayed writes of the
+//file opened as fd. blocks are reserved for them so that they fit on disk when
+//written. returns the number of bytes taken, which is smaller than count if
+//the disk is full
+static int fs_bufferWrite(fs_t *fs, int fd, int offset, struct ioVector *io, size_t count)
+{
+    int fileIndex = fs->openedFiles[fd].fileIndex;
+    struct writeBuffer *wb = &fs->writeBuffers[fileIndex];
+    struct blockMap *map = fs_getMap(fs, fileIndex);
+    if (wb->data == NULL) {
+        wb->data = malloc(WRITE_BUFFER_BYTES);
+    }
+    //without memory, write through
+    if (map == NULL || wb->data == NULL) {
+        if (fs_flushBuffer(fs, fd) == -1) {
+            return -1;
+        }
+        return fs_writeAt(fs, fd, offset, io, count);
+    }
+
+    //the buffer holds one range of the file: a write that doesn't extend it
+    //or that doesn't fit starts a new one
+    if (wb->length > 0 && (offset < wb->start || offset > wb->start + wb->length
+            || offset + count > (size_t)wb->start + WRITE_BUFFER_BYTES)) {
+        if (fs_flushBuffer(fs, fd) == -1) {
+            return -1;
+        }
+    }
+    if (count >= WRITE_BUFFER_BYTES) {
+        return fs_writeAt(fs, fd, offset, io, count);
+    }
+    if (wb->length == 0) {
+        wb->start = offset;
+    }
+
+    //reserve the blocks needed past the end of the chain, clamping the write
+    //to the free blocks that are not reserved yet
+    pthread_mutex_lock(&fs->fatLock);
+    int blocksFree = fs_freeCount(fs) - fs->reservedBlocks;
+    size_t maxEnd = (size_t)(map->count + wb->reserved + blocksFree) * BLOCK_BYTES;
+    if (offset + count > maxEnd) {
+        count = maxEnd > (size_t)offset ? maxEnd - offset : 0;
+    }
+    if (count == 0) {
+        pthread_mutex_unlock(&fs->fatLock);
+        return 0;
+    }
+    int end = offset + count;
+    if (end > wb->start + wb->length) {
+        int blocksNeeded = (end + BLOCK_BYTES - 1) / BLOCK_BYTES - map->count;
+        if (blocksNeeded > wb->reserved) {
+            fs->reservedBlocks += blocksNeeded - wb->reserved;
+            wb->reserved = blocksNeeded;
+        }
+        wb->length = end - wb->start;
+    }
+    pthread_mutex_unlock(&fs->fatLock);
+    fs_ioCopy(io, wb->data + offset - wb->start, count, false);
+    return count;
+}
+
+//writes the iovcnt buffers of iov in the file opened as fd, at position, or at
+//the file offset of fd which then moves past the bytes written if position is
+//NULL
+static int fs_writeFile(fs_t *fs, int fd, const struct iovec *iov, int iovcnt,
+    const size_t *position)
+{
+    /*CHECKING IF FD IS VALID*/
     //return -1 if fd is out of bounds
-    if (fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
+    if (fs == NULL || fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
         return -1;
     }
     //return -1 if fd is not opened
-    if (openedFiles[fd].filename[0] == '\0') {
+    if (!fs->openedFiles[fd].opened) {
         return -1;
     }
+    //return -1 if the buffers are invalid, skip if nothing to write
+    ssize_t length = fs_ioLength(iov, iovcnt);
+    if (length == -1) {
+        return -1;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    /*WRITING*/
+    //with delayed allocation, data waits in the file's buffer
+    int fileIndex = fs->openedFiles[fd].fileIndex;
+    pthread_rwlock_wrlock(&fs->fileLocks[fileIndex]);
+    //like lseek, a position cannot leave a hole past the end of the file
+    if (position != NULL && *position > (size_t)fs_fileSize(fs, fileIndex)) {
+        pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+        return -1;
+    }
+    int offset = position != NULL ? (int)*position : fs->openedFiles[fd].offset;
+    //no file can grow past what an int counts
+    size_t count = (size_t)length < (size_t)(INT_MAX - offset) ? (size_t)length
+        : (size_t)(INT_MAX - offset);
+    TRACE(WRITE, fd, offset, count);
+    struct ioVector io;
+    fs_ioInit(&io, iov, iovcnt);
+    int written = fs->delayedAlloc ? fs_bufferWrite(fs, fd, offset, &io, count)
+        : fs_writeAt(fs, fd, offset, &io, count);
+    pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+    if (written == -1) {
+        return -1;
+    }
+
+    //update offset and return final count of bytes written
+    if (position == NULL) {
+        fs->openedFiles[fd].offset = offset + written;
+    }
+    return written;
+}
+
+//times a write, and counts the bytes written
+static int fs_writeOp(fs_t *fs, int fd, const struct iovec *iov, int iovcnt,
+    const size_t *position)
+{
+    uint64_t start = fs_now();
+    int ret = fs_writeFile(fs, fd, iov, iovcnt, position);
+    fs_recordOp(fs, FS_OP_WRITE, start, ret);
+    if (ret > 0) {
+        counters_add(fs->stats, STAT_BYTES_WRITTEN, ret);
+    }
+    return ret;
+}
 
-    /*CLOSING FILE */
-    openedFiles[fd].filename[0] = '\0';
-    openedFiles[fd].offset = 0;
+int fs_write_ex(fs_t *fs, int fd, void *buf, size_t count)
+{
+    struct iovec iov = { buf, count };
+    return fs_writeOp(fs, fd, &iov, 1, NULL);
+}
 
-    //return 0 when file is successfully closed
-    return 0;
+int fs_pwrite_ex(fs_t *fs, int fd, void *buf, size_t count, size_t offset)
+{
+    struct iovec iov = { buf, count };
+    return fs_writeOp(fs, fd, &iov, 1, &offset);
 }
 
-int fs_stat(int fd)
+int fs_writev_ex(fs_t *fs, int fd, const struct iovec *iov, int iovcnt)
 {
-	/*CHECKING IF FD IS VALID*/
-    //return -1 if fd is out of bounds
-    if (fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
-        return -1;
-    }
-    //return -1 if fd is not opened
-    if (openedFiles[fd].filename[0] == '\0') {
-        return -1;
+    return fs_writeOp(fs, fd, iov, iovcnt, NULL);
+}
+
+//updates the sequential access detection of fd for a read of logical blocks
+//first to last, then starts reading the blocks that follow into the cache. the
+//window doubles on reads served by readahead and halves on random reads
+static void fs_readahead(fs_t *fs, int fd, int first, int last)
+{
+    struct fileDescriptor *desc = &fs->openedFiles[fd];
+    if (fs->readaheadMax == 0) {
+        return;
     }
 
-    /*GETTING SIZE*/
-    //search through root directory and find file index
-    char *filename = (char*)openedFiles[fd].filename;
-    char *tempname;
-    int fileIndex = -1;
-    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
-        tempname = (char*)root->files[i].filename;
-        if(strcmp(filename, tempname) == 0) {
-            fileIndex = i;
-            break;
+    if (first != desc->raLast && first != desc->raLast + 1) {
+        //random read: what was read ahead is not going to be used
+        desc->raMisses++;
+        desc->raWindow /= 2;
+        desc->raEnd = 0;
+    } else if (last > desc->raLast) {
+        if (last < desc->raEnd) {
+            desc->raHits++;
+            desc->raWindow *= 2;
+            if (desc->raWindow > fs->readaheadMax) {
+                desc->raWindow = fs->readaheadMax;
+            }
+        } else {
+            desc->raMisses++;
+            if (desc->raWindow < READAHEAD_MIN_BLOCKS) {
+                desc->raWindow = READAHEAD_MIN_BLOCKS < fs->readaheadMax ?
+                    READAHEAD_MIN_BLOCKS : fs->readaheadMax;
+            }
         }
     }
-    //get corresponding size and return it
-    int size = root->files[fileIndex].size;
-    return size;
+    desc->raLast = last;
+
+    //refill the window once half of it was read, so that blocks are
+    //requested in batches
+    if (desc->raWindow == 0 || desc->raEnd - (last + 1) > desc->raWindow / 2) {
+        return;
+    }
+    struct blockMap *map = fs_getMap(fs, desc->fileIndex);
+    if (map == NULL) {
+        return;
+    }
+    int fileBlocks = (fs->root->files[desc->fileIndex].size + BLOCK_BYTES - 1) / BLOCK_BYTES;
+    if (fileBlocks > map->count) {
+        fileBlocks = map->count;
+    }
+    int from = desc->raEnd > last + 1 ? desc->raEnd : last + 1;
+    int to = last + 1 + desc->raWindow < fileBlocks ? last + 1 + desc->raWindow : fileBlocks;
+    if (from >= to) {
+        return;
+    }
+
+    size_t blocks[READAHEAD_MAX_BLOCKS];
+    for (int i = from; i < to; i++) {
+        blocks[i - from] = map->blocks[i] + fs->sb->dataIndex;
+    }
+    cache_prefetch(fs->cache, blocks, to - from);
+    desc->raEnd = to;
 }
 
-int fs_lseek(int fd, size_t offset)
+int fs_reserve_ex(fs_t *fs, int fd, size_t bytes)
 {
-	/*CHECKING IF FD IS VALID*/
+    /*CHECKING IF FD IS VALID*/
     //return -1 if fd is out of bounds
-    if (fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
+    if (fs == NULL || fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
         return -1;
     }
     //return -1 if fd is not opened
-    if (openedFiles[fd].filename[0] == '\0') {
+    if (!fs->openedFiles[fd].opened) {
         return -1;
     }
 
-    /*CHECKING IF OFFSET IS VALID*/
-    //search through root directory and find file index
-    char *filename = (char*)openedFiles[fd].filename;
-    char *tempname;
-    int fileIndex = -1;
-    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
-        tempname = (char*)root->files[i].filename;
-        if(strcmp(filename, tempname) == 0) {
-            fileIndex = i;
-            break;
-        }
+    /*CHECKING HOW MANY BLOCKS ARE MISSING*/
+    int fileIndex = fs->openedFiles[fd].fileIndex;
+    pthread_rwlock_wrlock(&fs->fileLocks[fileIndex]);
+    int blocksHave;
+    uint16_t lastIndex = fs_chainEnd(fs, fd, &blocksHave);
+    size_t totalBlocks = (bytes + BLOCK_BYTES - 1) / BLOCK_BYTES;
+    if (totalBlocks <= (size_t)blocksHave) {
+        pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+        return 0;
     }
-    //return -1 if offset is out of bounds
-    if (offset < 0 || offset > root->files[fileIndex].size) {
-        return -1;
+    //either all the blocks are allocated or none, leaving the blocks reserved
+    //for delayed writes
+    size_t blocksNeeded = totalBlocks - blocksHave;
+    pthread_mutex_lock(&fs->fatLock);
+    int ret = -1;
+    if (blocksNeeded <= (size_t)(fs_freeCount(fs) - fs->reservedBlocks)) {
+        /*ALLOCATING BLOCKS*/
+        //blocks past the size of the file are used by the next writes
+        fs_growChain(fs, fileIndex, lastIndex, blocksNeeded);
+        ret = 0;
     }
-
-    /*SETTING OFFSET*/
-    //set new offset
-    openedFiles[fd].offset = offset;
-
-    //return 0 when offset is updated successfully 
-    return 0;
+    pthread_mutex_unlock(&fs->fatLock);
+    pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+    return ret;
 }
 
-int fs_write(int fd, void *buf, size_t count)
+//reads the file opened as fd into the iovcnt buffers of iov, from position, or
+//from the file offset of fd which then moves past the bytes read if position is
+//NULL
+static int fs_readFile(fs_t *fs, int fd, const struct iovec *iov, int iovcnt,
+    const size_t *position)
 {
-    /*CHECKING IF FD IS VALID*/
+	/*CHECKING IF FD IS VALID*/
     //return -1 if fd is out of bounds
-    if (fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
+    if (fs == NULL || fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
         return -1;
     }
     //return -1 if fd is not opened
-    if (openedFiles[fd].filename[0] == '\0') {
+    if (!fs->openedFiles[fd].opened) {
         return -1;
     }
-    //skip if nothing to write
-    if (count == 0) {
+    //return -1 if the buffers are invalid, skip if nothing to read
+    ssize_t length = fs_ioLength(iov, iovcnt);
+    if (length == -1) {
+        return -1;
+    }
+    if (length == 0) {
         return 0;
     }
+    size_t count = length;
 
-    if (FS_DEBUG) fprintf(stderr,"fs_write: fd=%d, count=%ld\n", fd, count);
+    /*FIND OUT NECESSARY VARIABLES*/
+    //descriptor knows its root directory entry
+    int fileIndex = fs->openedFiles[fd].fileIndex;
+    //delayed writes of the file must be on disk to be read, which takes the
+    //file lock for writing instead of reading
+    pthread_rwlock_rdlock(&fs->fileLocks[fileIndex]);
+    while (fs->writeBuffers[fileIndex].length > 0) {
+        pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+        pthread_rwlock_wrlock(&fs->fileLocks[fileIndex]);
+        int ret = fs_flushBuffer(fs, fd);
+        pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+        if (ret == -1) {
+            return -1;
+        }
+        pthread_rwlock_rdlock(&fs->fileLocks[fileIndex]);
+    }
 
-    /*FINDING FILE IN ROOT DIRECTORY*/
-    //search through root directory
-    char *filename = (char*)openedFiles[fd].filename;
-    char *tempname;
-    int fileIndex = -1;
-    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
-        tempname = (char*)root->files[i].filename;
-        if(strcmp(filename, tempname) == 0) {
-            fileIndex = i;
+    //calculate how many bytes can be read
+    int size = fs->root->files[fileIndex].size;
+    if (position != NULL && *position >= (size_t)size) {
+        pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+        return 0;
+    }
+    int offset = position != NULL ? (int)*position : fs->openedFiles[fd].offset;
+    TRACE(READ, fd, offset, count);
+    if (offset >= size) {
+        pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+        return 0;
+    }
+    if (count > (size_t)(size - offset)) {
+        count = size - offset;
+    }
+    //finding number of blocks to go through
+    int totalBlocks = (offset + count) / BLOCK_BYTES - offset / BLOCK_BYTES;
+    if ((offset + count) % BLOCK_BYTES) {
+        totalBlocks++;
+    }
+
+    /*READ AHEAD*/
+    //following blocks are read asynchronously while these ones are copied.
+    //reads at a position don't take part in the detection of fd
+    if (position == NULL) {
+        fs_readahead(fs, fd, offset / BLOCK_BYTES, (offset + count - 1) / BLOCK_BYTES);
+    }
+
+    /*SKIP TO THE BLOCK HOLDING THE OFFSET*/
+    //reads at a position walk from a cursor of their own, since other threads
+    //may be reading through fd at the same time
+    struct chainCursor own = { fs->root->files[fileIndex].firstIndex, 0 };
+    struct chainCursor *cursor = position != NULL ? &own : &fs->openedFiles[fd].cursor;
+    int blockNumber = offset / BLOCK_BYTES;
+    uint16_t currentIndex = fs_seekBlock(fs, fileIndex, cursor, blockNumber);
+
+    /*READ ONE RUN OF CONTIGUOUS BLOCKS AT A TIME*/
+    struct ioVector io;
+    fs_ioInit(&io, iov, iovcnt);
+    int startOffset = offset % BLOCK_BYTES;
+    int blocksLeft = totalBlocks;
+    size_t readCount = 0;
+
+    while (readCount < count) {
+        uint16_t runStart = currentIndex;
+        int runLength = fs_nextRun(fs, &currentIndex, 
+            blocksLeft < RUN_MAX_BLOCKS ? blocksLeft : RUN_MAX_BLOCKS);
+        int runBytes = runLength * BLOCK_BYTES - startOffset;
+        int copyCount = count - readCount < runBytes ? count - readCount : runBytes;
+
+        TRACE(RUN, runStart, runLength, copyCount);
+
+        if (fs_transferRun(fs, runStart, startOffset, copyCount, &io, false) == -1) {
             break;
         }
+
+        //leave the cursor on the last block of the run
+        blockNumber += runLength;
+        cursor->index = currentIndex;
+        cursor->block = blockNumber - 1;
+
+        readCount += copyCount;
+        blocksLeft -= runLength;
+        startOffset = 0;
+        currentIndex = fs_getFat(fs, currentIndex);
+        fs_countHops(fs, 1);
     }
-    //set current block index
-    uint16_t currentIndex = root->files[fileIndex].firstIndex;
 
-    /*CHECKING HOW MUCH SPACE IS NEEDED*/
-    //calculate how many total blocks are needed
-    int totalBytes = openedFiles[fd].offset + (int)count; 
-    int totalBlocks = totalBytes / BLOCK_BYTES;
-    if (totalBytes % BLOCK_BYTES > 0) {
-        totalBlocks++;
+    pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+
+    //change offset
+    if (position == NULL) {
+        fs->openedFiles[fd].offset = offset + readCount;
     }
+    
+    //return final count of bytes read if successfully read
+    return readCount;
+}
 
-    if (FS_DEBUG) fprintf(stderr,"fs_write: fd=%d, totalBlocks=%d\n", fd, totalBlocks);
+//times a read, and counts the bytes read
+static int fs_readOp(fs_t *fs, int fd, const struct iovec *iov, int iovcnt,
+    const size_t *position)
+{
+    uint64_t start = fs_now();
+    int ret = fs_readFile(fs, fd, iov, iovcnt, position);
+    fs_recordOp(fs, FS_OP_READ, start, ret);
+    if (ret > 0) {
+        counters_add(fs->stats, STAT_BYTES_READ, ret);
+    }
+    return ret;
+}
 
-    //calculating how many data blocks we have
-    int blocksHave = 0;
-    uint16_t lastIndex = currentIndex;
-    while (currentIndex != 0xFFFF) {
-        lastIndex = currentIndex;
-        blocksHave++;
-        currentIndex = fat[currentIndex];
-    }
-    //calculating how many more blocks we need
-    int blocksNeeded = totalBlocks - blocksHave;
+int fs_read_ex(fs_t *fs, int fd, void *buf, size_t count)
+{
+    struct iovec iov = { buf, count };
+    return fs_readOp(fs, fd, &iov, 1, NULL);
+}
 
-    if (FS_DEBUG) fprintf(stderr,"fs_write: fd=%d, blocksNeeded=%d\n", fd, blocksNeeded);
+int fs_pread_ex(fs_t *fs, int fd, void *buf, size_t count, size_t offset)
+{
+    struct iovec iov = { buf, count };
+    return fs_readOp(fs, fd, &iov, 1, &offset);
+}
 
-    /*ASSIGN/DEASSIGN BLOCKS TO MEET TOTAL NUMBER OF BLOCKS*/
-    //if blocks need to be assigned, assign as many as possible
-    if (blocksNeeded > 0) {
-        //start assigning blocks as necessary
-        int i = 0;
-        while (blocksNeeded > 0 && i < sb->numDBlocks) {
-            if (FS_DEBUG) fprintf(stderr, "fs_write: Finding Blocks blocksNeeded=%d, i=%d, lastIndex=%d\n",
-                blocksNeeded, i, lastIndex);
-            //if fat entry is empty then assign new block
-            if (fat[i] == 0) {
-                if (FS_DEBUG) fprintf(stderr, "fs_write: Assigning block %d\n", i);
-                blocksNeeded--;
-                if (blocksNeeded == 0) fat[i] = 0xFFFF;
-                fat[lastIndex] = i;
-                lastIndex = i;
-            }
-            if (FS_DEBUG) fs_printFileBlocks();
+int fs_readv_ex(fs_t *fs, int fd, const struct iovec *iov, int iovcnt)
+{
+    return fs_readOp(fs, fd, iov, iovcnt, NULL);
+}
 
-            i++;
+/*DEFRAGMENTATION*/
+//returns the number of extents of the chain of root directory entry fileIndex,
+//and sets blocks to its length
+static int fs_countExtents(fs_t *fs, int fileIndex, int *blocks)
+{
+    uint16_t index = fs->root->files[fileIndex].firstIndex;
+    int extents = 1;
+    *blocks = 1;
+    while (fs_getFat(fs, index) != 0xFFFF) {
+        if (fs_getFat(fs, index) != index + 1) {
+            extents++;
         }
+        index = fs_getFat(fs, index);
+        (*blocks)++;
     }
-    //if blocks need to be deassigned, deassign excess blocks
-    else if (blocksNeeded < 0) {
-        //go to last blocked needed and deassign rest
-        int blockCount = 0;
-        currentIndex = root->files[fileIndex].firstIndex;
-        while (blocksNeeded != 0) {
-            if (blockCount < totalBlocks) {
-                
-            }
-            blockCount++;
-            currentIndex = fat[currentIndex];
-            
+    fs_countHops(fs, *blocks - 1);
+    return extents;
+}
+
+//makes the chain starting at data block firstIndex the one of root directory
+//entry fileIndex, whose descriptors forget the blocks of the previous one.
+//dirLock must be held for writing
+static void fs_switchChain(fs_t *fs, int fileIndex, uint16_t firstIndex)
+{
+    fs->root->files[fileIndex].firstIndex = firstIndex;
+    fs_dirtyEntry(fs, fileIndex);
+    if (fs->blockMaps[fileIndex].blocks != NULL) {
+        fs_dropMap(fs, fileIndex);
+    }
+    for (int i = 0; i < MAX_OPEN_FILE_DESCRIPTORS; i++) {
+        if (fs->openedFiles[i].opened && fs->openedFiles[i].fileIndex == fileIndex) {
+            fs->openedFiles[i].cursor.index = firstIndex;
+            fs->openedFiles[i].cursor.block = 0;
+            fs->openedFiles[i].raEnd = 0;
         }
     }
+}
 
-    if (FS_DEBUG) fs_printFileBlocks();
-
-    if (FS_DEBUG) fprintf(stderr,"fs_write: fd=%d, totalBlocks=%d\n", 
-        fileIndex, totalBlocks);
+//moves the chain of root directory entry fileIndex, blocks long, to a free run
+//of its length. the data and the new chain are durable before the root
+//directory points to the new chain, which is durable before the old chain is
+//released, so that a crash leaves one of the two chains complete. on failure,
+//the file keeps its old chain and the new one is released. returns 1 if there
+//is no free run long enough. the file lock must be held for writing and the
+//file kept from being deleted. dirLock is only taken to switch chains, so that
+//directory operations don't wait for the copy
+static int fs_relocate(fs_t *fs, int fileIndex, int blocks)
+{
+    /*BUILDING NEW CHAIN*/
+    //the file needs a free run of its length, outside the blocks reserved
+    //for delayed writes
+    size_t runLength;
+    pthread_mutex_lock(&fs->fatLock);
+    fs_scanAll(fs);
+    long target = freemap_best_run(fs->freeMap, blocks, &runLength);
+    if (target == -1 || runLength < (size_t)blocks ||
+        blocks > fs_freeCount(fs) - fs->reservedBlocks) {
+        pthread_mutex_unlock(&fs->fatLock);
+        return 1;
+    }
+    for (int i = 0; i < blocks; i++) {
+        freemap_set_used(fs->freeMap, target + i);
+        fs_setFat(fs, target + i, i == blocks - 1 ? 0xFFFF : target + i + 1);
+    }
+    pthread_mutex_unlock(&fs->fatLock);
 
-    /*COPY FROM BOUNCE BUFFER*/
-    //copying over data blocks into BLOCK_BYTES bounce buffer
-    char bounce[BLOCK_BYTES];
-    int i = 0;
+    char *bounce = block_buf_get();
+    if (bounce == NULL) {
+        goto release;
+    }
 
-    /*COPY TO FINAL BUFFER WITH OFFSET AND COUNT*/
-    //calculate how many bytes can be read
-    int totalCount = count - openedFiles[fd].offset;
-    int realCount = totalCount;
-    int startOffset = openedFiles[fd].offset;
-    int copyCount = 0;
-    currentIndex = root->files[fileIndex].firstIndex;
-
-    for (i=0; i < totalBlocks; ++i) {
-        // after first block, reset startOffset to 0
-        if (i > 0) startOffset = 0;
-        // set size for strncopy
-        if (realCount > BLOCK_BYTES) {
-            copyCount = BLOCK_BYTES;
-        } else {
-            copyCount = realCount;
-        }
-        if (FS_DEBUG) fprintf(stderr, "fs_write: currentIndex=%d, start=%d, count=%d\n",
-            currentIndex, startOffset, realCount);
-        //copy to final buffer
-        strncpy(bounce + startOffset, buf+(i*BLOCK_BYTES), copyCount);
-        block_write(currentIndex + sb->dataIndex, bounce);
-        currentIndex = fat[currentIndex];
-        realCount = realCount - BLOCK_BYTES;
-    }  
-    
-    //change size and update offset
-    root->files[fileIndex].size = count + openedFiles[fd].offset;
-    openedFiles[fd].offset = root->files[fileIndex].size;
-    if (FS_DEBUG) fprintf(stderr, "fs_write: size=%d, offset=%d\n",
-        root->files[fileIndex].size, openedFiles[fd].offset);
-    
-    //return final count of bytes read if successfully read
-    return totalCount;
+    /*COPYING DATA*/
+    //one run of the old chain at a time. the chain cannot change while the
+    //file is locked and kept from being deleted
+    uint16_t oldIndex = fs->root->files[fileIndex].firstIndex;
+    uint16_t index = oldIndex;
+    int copied = 0;
+    while (copied < blocks) {
+        uint16_t runStart = index;
+        int runLength = fs_nextRun(fs, &index, RUN_MAX_BLOCKS);
+        if (cache_read_range(fs->cache, runStart + fs->sb->dataIndex, runLength, bounce) == -1 ||
+            cache_write_range(fs->cache, target + copied + fs->sb->dataIndex, runLength, bounce) == -1) {
+            break;
+        }
+        copied += runLength;
+        index = fs_getFat(fs, index);
+        fs_countHops(fs, 1);
+    }
+    block_buf_put(bounce);
+    //without a journal, the new chain is written ahead of the root directory
+    //instead of in the same transaction. metadata modified in place is
+    //already in the mapping
+    bool durable = copied == blocks && cache_flush(fs->cache) == 0;
+    if (durable && !fs->journaled && !fs->metaMapped) {
+        pthread_mutex_lock(&fs->fatLock);
+        durable = fs_writeFat(fs) == 0;
+        pthread_mutex_unlock(&fs->fatLock);
+    }
+    if (!durable || block_disk_sync_ex(fs->disk) == -1) {
+        goto release;
+    }
 
+    /*SWITCHING CHAINS*/
+    pthread_rwlock_wrlock(&fs->dirLock);
+    fs_switchChain(fs, fileIndex, target);
+    int ret = fs_commitMeta(fs, false);
+    pthread_rwlock_unlock(&fs->dirLock);
+    if (ret == -1 || block_disk_sync_ex(fs->disk) == -1) {
+        //the root directory on disk may point to either chain, and the old
+        //one is untouched, so the file goes back to it
+        pthread_rwlock_wrlock(&fs->dirLock);
+        fs_switchChain(fs, fileIndex, oldIndex);
+        pthread_rwlock_unlock(&fs->dirLock);
+        goto release;
+    }
+    pthread_mutex_lock(&fs->fatLock);
+    fs_countHops(fs, fs_freeChain(fs, oldIndex));
+    pthread_mutex_unlock(&fs->fatLock);
     return 0;
+
+release:
+    //the new chain is not the file's one
+    pthread_mutex_lock(&fs->fatLock);
+    for (int i = 0; i < blocks; i++) {
+        fs_freeBlock(fs, target + i);
+    }
+    pthread_mutex_unlock(&fs->fatLock);
+    return -1;
 }
 
-int fs_read(int fd, void *buf, size_t count)
+int fs_defrag_ex(fs_t *fs, size_t max_blocks, unsigned int max_ms, struct fs_defrag_stats *stats)
 {
-	/*CHECKING IF FD IS VALID*/
-    //return -1 if fd is out of bounds
-    if (fd < 0 || fd > MAX_OPEN_FILE_DESCRIPTORS - 1) {
+    //check if a virtual disk was opened
+    if (fs == NULL) {
         return -1;
     }
-    //return -1 if fd is not opened
-    if (openedFiles[fd].filename[0] == '\0') {
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct fs_defrag_stats done = { 0 };
+    bool complete = true;
+    int ret = 0;
+    pthread_mutex_lock(&fs->defragLock);
+
+    /*VISITING FILES*/
+    //passes resume where the previous one stopped
+    for (int visited = 0; visited < NUM_ROOTDIR_ENTRIES; visited++) {
+        //budget is checked between files, since a file is moved whole
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+            (now.tv_nsec - start.tv_nsec) / 1000000;
+        if ((max_blocks > 0 && done.blocks >= max_blocks) ||
+            (max_ms > 0 && elapsed >= max_ms)) {
+            complete = false;
+            break;
+        }
+
+        //readers and writers of the file wait while it is moved. directory
+        //operations only wait while it is picked and while its chain is
+        //switched, and cannot delete it meanwhile
+        int fileIndex = fs->defragNext;
+        pthread_rwlock_wrlock(&fs->fileLocks[fileIndex]);
+        pthread_rwlock_wrlock(&fs->dirLock);
+        int blocks;
+        bool move = false;
+        if (fs->root->files[fileIndex].filename[0] == '\0' ||
+            fs_countExtents(fs, fileIndex, &blocks) == 1) {
+            fs->defragNext = (fileIndex + 1) % NUM_ROOTDIR_ENTRIES;
+        //a file bigger than the rest of the budget waits for the next pass,
+        //unless nothing was moved yet
+        } else if (max_blocks > 0 && done.blocks > 0 && done.blocks + blocks > max_blocks) {
+            complete = false;
+        } else {
+            fs->defragNext = (fileIndex + 1) % NUM_ROOTDIR_ENTRIES;
+            fs->defragFile = fileIndex;
+            move = true;
+        }
+        pthread_rwlock_unlock(&fs->dirLock);
+        if (move) {
+            ret = fs_relocate(fs, fileIndex, blocks);
+            if (ret == 1) {
+                done.skipped++;
+                ret = 0;
+            } else if (ret == 0) {
+                done.files++;
+                done.blocks += blocks;
+            }
+            pthread_rwlock_wrlock(&fs->dirLock);
+            fs->defragFile = -1;
+            pthread_rwlock_unlock(&fs->dirLock);
+        }
+        pthread_rwlock_unlock(&fs->fileLocks[fileIndex]);
+        if (!complete || ret == -1) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fs->defragLock);
+
+    if (ret == -1) {
         return -1;
     }
-    //skip if nothing to read
-    if (count == 0) {
-        return 0;
+    if (stats != NULL) {
+        *stats = done;
     }
+    return complete ? 0 : 1;
+}
 
-    if (FS_DEBUG) fprintf(stderr,"fs_read: fd=%d, count=%ld\n", fd, count);
+int fs_get_stats_ex(fs_t *fs, struct fs_stats *stats)
+{
+    //check if a virtual disk was opened
+    if (fs == NULL || stats == NULL) {
+        return -1;
+    }
 
-    /*FIND OUT NECESSARY VARIABLES*/
-    //search through root directory and find file index
-    char *filename = (char*)openedFiles[fd].filename;
-    char *tempname;
-    int fileIndex = -1;
-    for (int i = 0; i < NUM_ROOTDIR_ENTRIES; i++) {
-        tempname = (char*)root->files[i].filename;
-        if(strcmp(filename, tempname) == 0) {
-            fileIndex = i;
-            break;
+    uint64_t sums[NUM_STATS];
+    counters_read(fs->stats, sums);
+    for (int op = 0; op < FS_OP_COUNT; op++) {
+        stats->ops[op].calls = sums[STAT_CALLS(op)];
+        stats->ops[op].errors = sums[STAT_ERRORS(op)];
+        stats->ops[op].total_ns = sums[STAT_NS(op)];
+        for (int i = 0; i < FS_STATS_BUCKETS; i++) {
+            stats->ops[op].latency[i] = sums[STAT_LATENCY(op, i)];
         }
     }
+    stats->bytes_read = sums[STAT_BYTES_READ];
+    stats->bytes_written = sums[STAT_BYTES_WRITTEN];
+    stats->fat_hops = sums[STAT_FAT_HOPS];
+    stats->dir_entries = sums[STAT_DIR_ENTRIES];
+
+    //requests to the disk are counted by the disk itself
+    struct block_disk_stats diskStats;
+    if (block_disk_stats_ex(fs->disk, &diskStats) == -1) {
+        return -1;
+    }
+    stats->disk_reads = diskStats.reads;
+    stats->disk_writes = diskStats.writes;
+    stats->blocks_read = diskStats.blocks_read;
+    stats->blocks_written = diskStats.blocks_written;
+    return 0;
+}
 
-    //finding first index
-    uint16_t currentIndex = root->files[fileIndex].firstIndex;
-    //finding number of total blocks
-    int totalBlocks = root->files[fileIndex].size / BLOCK_BYTES;
-    if (root->files[fileIndex].size % BLOCK_BYTES) {
-        totalBlocks++;
+/*FUNCTIONS ON THE MOUNTED FILE SYSTEM*/
+//mounts the passed file system with default options
+int fs_mount(const char *diskname)
+{
+    return fs_mount_opts(diskname, NULL);
+}
+
+//mounts the passed file system
+int fs_mount_opts(const char *diskname, const struct fs_options *opts)
+{
+    //only one file system is mounted at a time through these functions
+    if (mounted != NULL) {
+        return -1;
+    }
+    mounted = fs_mount_ex(diskname, opts);
+    return mounted == NULL ? -1 : 0;
+}
+
+int fs_umount(void)
+{
+    if (fs_umount_ex(mounted) == -1) {
+        return -1;
     }
+    mounted = NULL;
+    return 0;
+}
 
-    if (FS_DEBUG) fprintf(stderr,"fs_read: fileIndex=%d, totalBlocks=%d\n", 
-        fileIndex, totalBlocks);
+int fs_sync(void)
+{
+    return fs_sync_ex(mounted);
+}
 
-    /*COPY ONTO BOUNCE BUFFER*/
-    //copying over data blocks into BLOCK_BYTES bounce buffer
-    char bounce[BLOCK_BYTES];
-    int i = 0;
+int fs_cache_stats(struct fs_cache_stats *stats)
+{
+    return fs_cache_stats_ex(mounted, stats);
+}
 
-    /*COPY TO FINAL BUFFER WITH OFFSET AND COUNT*/
-    //calculate how many bytes can be read
-    int totalCount = count - openedFiles[fd].offset;
-    int realCount = totalCount;
-    int startOffset = openedFiles[fd].offset;
-    int copyCount = 0;
-
-    for (i=0; i < totalBlocks; ++i) {
-        // after first block, reset startOffset to 0
-        if (i > 0) startOffset = 0;
-        // set size for strncopy
-        if (realCount > BLOCK_BYTES) {
-            copyCount = BLOCK_BYTES;
-        } else {
-            copyCount = realCount;
-        }
-        if (FS_DEBUG) fprintf(stderr, "fs_read: currentIndex=%d, start=%d, count=%d\n",
-            currentIndex, startOffset, realCount);
-        block_read(currentIndex + sb->dataIndex, bounce);
-        //copy to final buffer
-        strncpy(buf+(i*BLOCK_BYTES), bounce + startOffset, copyCount);
-        currentIndex = fat[currentIndex];
-        realCount = realCount - BLOCK_BYTES;
-    }  
-    
-    //change offset
-    openedFiles[fd].offset = root->files[fileIndex].size;
-    
-    //return final count of bytes read if successfully read
-    return totalCount;
+int fs_info(void)
+{
+    return fs_info_ex(mounted);
+}
+
+int fs_create(const char *filename)
+{
+    return fs_create_ex(mounted, filename);
+}
+
+int fs_delete(const char *filename)
+{
+    return fs_delete_ex(mounted, filename);
+}
+
+int fs_ls(void)
+{
+    return fs_ls_ex(mounted);
+}
+
+int fs_open(const char *filename)
+{
+    return fs_open_ex(mounted, filename);
+}
+
+int fs_close(int fd)
+{
+    return fs_close_ex(mounted, fd);
+}
+
+int fs_readahead_stats(int fd, struct fs_readahead_stats *stats)
+{
+    return fs_readahead_stats_ex(mounted, fd, stats);
+}
+
+int fs_stat(int fd)
+{
+    return fs_stat_ex(mounted, fd);
+}
+
+int fs_lseek(int fd, size_t offset)
+{
+    return fs_lseek_ex(mounted, fd, offset);
+}
+
+int fs_write(int fd, void *buf, size_t count)
+{
+    return fs_write_ex(mounted, fd, buf, count);
+}
+
+int fs_reserve(int fd, size_t bytes)
+{
+    return fs_reserve_ex(mounted, fd, bytes);
+}
+
+int fs_read(int fd, void *buf, size_t count)
+{
+    return fs_read_ex(mounted, fd, buf, count);
+}
+
+int fs_pread(int fd, void *buf, size_t count, size_t offset)
+{
+    return fs_pread_ex(mounted, fd, buf, count, offset);
+}
+
+int fs_pwrite(int fd, void *buf, size_t count, size_t offset)
+{
+    return fs_pwrite_ex(mounted, fd, buf, count, offset);
+}
+
+int fs_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    return fs_readv_ex(mounted, fd, iov, iovcnt);
+}
+
+int fs_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    return fs_writev_ex(mounted, fd, iov, iovcnt);
+}
+
+int fs_defrag(size_t max_blocks, unsigned int max_ms, struct fs_defrag_stats *stats)
+{
+    return fs_defrag_ex(mounted, max_blocks, max_ms, stats);
+}
+
+int fs_get_stats(struct fs_stats *stats)
+{
+    return fs_get_stats_ex(mounted, stats);
+}
+
+int fs_batch(struct fs_batch_item *items, size_t count)
+{
+    return fs_batch_ex(mounted, items, count);
 }
@@ -2,6 +2,7 @@
 #define _FS_H
 
 #include <stddef.h> /* for size_t definition */
+#include <sys/uio.h> /* for struct iovec definition */
 
 /** Maximum filename length (including the NULL character) */
 #define FS_FILENAME_LEN 16
@@ -12,6 +13,175 @@
 /** Maximum number of open files */
 #define FS_OPEN_MAX_COUNT 32
 
+/** Default number of blocks held by the block cache */
+#define FS_CACHE_BLOCKS 64
+
+/**
+ * struct fs_options - File system mount options
+ * @cache_blocks: Number of data blocks kept in the block cache (0 disables the
+ *                cache)
+ * @disk_mode: Access mode of the virtual disk file (&enum block_disk_mode from
+ *             disk.h). With %BLOCK_DISK_MMAP, the superblock, FAT and root
+ *             directory are used in place in the mapping and the block cache
+ *             is disabled. With %BLOCK_DISK_DIRECT, data bypasses the host's
+ *             page cache and the block cache is the only one.
+ * @delayed_alloc: Whether fs_write() only buffers data, per file, until the
+ *                 buffer is full, the file is read or closed, or fs_sync() is
+ *                 called. Blocks are then allocated for the whole buffer at
+ *                 once, and the last block of small appends is written once
+ * @journal_blocks: Number of data blocks to set aside for a metadata journal if
+ *                  the volume has none yet, or 0 not to create one. The journal
+ *                  is made at least twice as large as the FAT and root
+ *                  directory together. Ignored with %BLOCK_DISK_MMAP
+ */
+struct fs_options {
+	size_t cache_blocks;
+	int disk_mode;
+	int delayed_alloc;
+	size_t journal_blocks;
+};
+
+/**
+ * struct fs_cache_stats - Block cache counters
+ * @hits: Number of block accesses served from the cache
+ * @misses: Number of block accesses that went to the disk
+ * @evictions: Number of cached blocks dropped to make room for other ones
+ * @writebacks: Number of dirty blocks written back to the disk
+ * @prefetches: Number of blocks read ahead of sequential readers
+ * @prefetch_hits: Number of blocks read ahead which were then accessed
+ */
+struct fs_cache_stats {
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t writebacks;
+	size_t prefetches;
+	size_t prefetch_hits;
+};
+
+/**
+ * struct fs_readahead_stats - Readahead state of a file descriptor
+ * @window: Number of blocks currently read ahead of the file offset
+ * @hits: Number of reads whose blocks had been read ahead
+ * @misses: Number of reads whose blocks had not been read ahead
+ */
+struct fs_readahead_stats {
+	size_t window;
+	size_t hits;
+	size_t misses;
+};
+
+/**
+ * struct fs_defrag_stats - Outcome of a defragmentation pass
+ * @files: Number of files made contiguous
+ * @blocks: Number of blocks moved
+ * @skipped: Number of fragmented files left as they are, for lack of a free run
+ *           long enough to hold them
+ */
+struct fs_defrag_stats {
+	size_t files;
+	size_t blocks;
+	size_t skipped;
+};
+
+/**
+ * enum fs_batch_op - Operations of a batch
+ * @FS_BATCH_CREATE: Create an empty file, as fs_create()
+ * @FS_BATCH_DELETE: Delete a file, as fs_delete()
+ * @FS_BATCH_RENAME: Rename a file, which may be open. Fails if the new name is
+ *                   invalid or taken
+ * @FS_BATCH_TRUNCATE: Shrink a file which is not open. Fails if the new size is
+ *                     larger than the file
+ */
+enum fs_batch_op {
+	FS_BATCH_CREATE,
+	FS_BATCH_DELETE,
+	FS_BATCH_RENAME,
+	FS_BATCH_TRUNCATE,
+};
+
+/**
+ * struct fs_batch_item - Operation of a batch
+ * @op: Operation (&enum fs_batch_op)
+ * @filename: Name of the file operated on
+ * @newname: New name of the file, for %FS_BATCH_RENAME
+ * @size: New size of the file in bytes, for %FS_BATCH_TRUNCATE
+ * @result: Set to the result of the operation: 0 if it succeeded, -1 if it
+ *          failed
+ */
+struct fs_batch_item {
+	int op;
+	const char *filename;
+	const char *newname;
+	size_t size;
+	int result;
+};
+
+/** Number of buckets of the latency histograms of &struct fs_op_stats */
+#define FS_STATS_BUCKETS 32
+
+/**
+ * enum fs_op - Operations timed by fs_get_stats()
+ */
+enum fs_op {
+	FS_OP_MOUNT,
+	FS_OP_CREATE,
+	FS_OP_OPEN,
+	FS_OP_READ,
+	FS_OP_WRITE,
+	FS_OP_DELETE,
+	FS_OP_BATCH,
+	FS_OP_COUNT,
+};
+
+/**
+ * struct fs_op_stats - Counters of one operation
+ * @calls: Number of calls
+ * @errors: Number of calls which returned -1
+ * @total_ns: Time spent in the calls, in nanoseconds
+ * @latency: Latency histogram: bucket i counts the calls which took from 2^i
+ *           to 2^(i+1) - 1 nanoseconds, and the last one all the longer ones
+ */
+struct fs_op_stats {
+	size_t calls;
+	size_t errors;
+	size_t total_ns;
+	size_t latency[FS_STATS_BUCKETS];
+};
+
+/**
+ * struct fs_stats - File system counters
+ * @ops: Counters of each operation, indexed by &enum fs_op
+ * @disk_reads: Number of read requests issued to the virtual disk
+ * @disk_writes: Number of write requests issued to the virtual disk
+ * @blocks_read: Number of blocks read from the virtual disk
+ * @blocks_written: Number of blocks written to the virtual disk
+ * @bytes_read: Number of bytes returned by fs_read(), fs_pread() and fs_readv()
+ * @bytes_written: Number of bytes accepted by fs_write(), fs_pwrite() and
+ *                 fs_writev()
+ * @fat_hops: Number of FAT entries followed while walking block chains
+ * @dir_entries: Number of root directory entries examined by lookups and scans
+ */
+struct fs_stats {
+	struct fs_op_stats ops[FS_OP_COUNT];
+	size_t disk_reads;
+	size_t disk_writes;
+	size_t blocks_read;
+	size_t blocks_written;
+	size_t bytes_read;
+	size_t bytes_written;
+	size_t fat_hops;
+	size_t dir_entries;
+};
+
+/*
+ * Mounted file system, taken by the _ex variants of the functions below. Any
+ * number of file systems can be mounted at the same time, each from its own
+ * virtual disk file, and used by different threads. The functions without a
+ * file system argument operate on the one mounted by fs_mount().
+ */
+typedef struct fs fs_t;
+
 /**
  * fs_mount - Mount a file system
  * @diskname: Name of the virtual disk file
@@ -20,11 +190,40 @@
  * contains. A file system needs to be mounted before files can be read from it
  * with fs_read() or written to it with fs_write().
  *
+ * FAT blocks are read when first needed. fs_umount() leaves the number of free
+ * blocks of each FAT block in the superblock, so that mounting a volume which
+ * was cleanly unmounted takes the same time whatever its size. Otherwise, the
+ * whole FAT is read to find the free blocks.
+ *
+ * If the volume has a metadata journal, the transactions committed since the
+ * FAT and root directory were last written back are replayed first, so that
+ * the changes made durable by fs_sync() survive a crash.
+ *
+ * Once mounted, the file system can be used by several threads at the same
+ * time. Directory operations are serialized, while reads of a file, fs_stat()
+ * and fs_lseek() only exclude writes to the same file, so that files are
+ * accessed in parallel. A file descriptor must not be used by two threads at
+ * the same time, except by fs_pread() and fs_pwrite() which don't use its
+ * offset, and fs_mount() and fs_umount() must not run concurrently with any
+ * other call.
+ *
  * Return: -1 if virtual disk file @diskname cannot be opened, or if no valid
  * file system can be located. 0 otherwise.
  */
 int fs_mount(const char *diskname);
 
+/**
+ * fs_mount_opts - Mount a file system with options
+ * @diskname: Name of the virtual disk file
+ * @opts: Mount options, or NULL for the default ones
+ *
+ * Same as fs_mount(), but configured by @opts.
+ *
+ * Return: -1 if virtual disk file @diskname cannot be opened, or if no valid
+ * file system can be located. 0 otherwise.
+ */
+int fs_mount_opts(const char *diskname, const struct fs_options *opts);
+
 /**
  * fs_umount - Unmount file system
  *
@@ -36,6 +235,36 @@ int fs_mount(const char *diskname);
  */
 int fs_umount(void);
 
+/**
+ * fs_sync - Synchronize file system
+ *
+ * Write all the cached data blocks and the file system's meta-information back
+ * to the underlying virtual disk, and flush the virtual disk file to storage.
+ * Only the FAT blocks and the root directory modified since the last
+ * synchronization are written, so that it is cheap to call often.
+ *
+ * On a volume with a metadata journal (see &struct fs_options), the FAT entries
+ * and root directory entries modified since the last synchronization are
+ * instead logged as one transaction, written to the journal in a single
+ * request. The FAT blocks and the root directory are only written back when the
+ * journal fills up and when unmounting. Threads calling fs_sync() while another
+ * one is running wait for it, then get their changes committed together by a
+ * single synchronization.
+ *
+ * Return: -1 if no underlying virtual disk was opened, or if writing to it
+ * failed. 0 otherwise.
+ */
+int fs_sync(void);
+
+/**
+ * fs_cache_stats - Get block cache counters
+ * @stats: Structure to be filled with the counters
+ *
+ * Return: -1 if no underlying virtual disk was opened or if @stats is NULL. 0
+ * otherwise.
+ */
+int fs_cache_stats(struct fs_cache_stats *stats);
+
 /**
  * fs_info - Display information about file system
  *
@@ -55,8 +284,9 @@ int fs_info(void);
  * character).
  *
  * Return: -1 if @filename is invalid, if a file named @filename already exists,
- * or if string @filename is too long, or if the root directory already contains
- * %FS_FILE_MAX_COUNT files. 0 otherwise.
+ * or if string @filename is too long, if the root directory already contains
+ * %FS_FILE_MAX_COUNT files, or if no data block is free for the file, blocks
+ * held for delayed writes not counting as free. 0 otherwise.
  */
 int fs_create(const char *filename);
 
@@ -68,7 +298,8 @@ int fs_create(const char *filename);
  * system.
  *
  * Return: -1 if @filename is invalid, if there is no file named @filename to
- * delete, or if file @filename is currently open. 0 otherwise.
+ * delete, or if file @filename is currently open or being moved by
+ * fs_defrag(). 0 otherwise.
  */
 int fs_delete(const char *filename);
 
@@ -121,6 +352,22 @@ int fs_close(int fd);
  */
 int fs_stat(int fd);
 
+/**
+ * fs_readahead_stats - Get readahead state of a file descriptor
+ * @fd: File descriptor
+ * @stats: Structure to be filled with the readahead state of @fd
+ *
+ * Reads which continue where the previous read of @fd stopped are sequential.
+ * The blocks following a sequential read are read asynchronously into the
+ * block cache, up to a window which doubles when reads find their blocks
+ * already read ahead and halves on non-sequential reads. The window is at most
+ * half of the cache, so readahead is disabled without a cache.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open) or if @stats is NULL. 0 otherwise.
+ */
+int fs_readahead_stats(int fd, struct fs_readahead_stats *stats);
+
 /**
  * fs_lseek - Set file offset
  * @fd: File descriptor
@@ -157,6 +404,22 @@ int fs_lseek(int fd, size_t offset);
  */
 int fs_write(int fd, void *buf, size_t count);
 
+/**
+ * fs_reserve - Preallocate space for a file
+ * @fd: File descriptor
+ * @bytes: Number of bytes the file is expected to grow to
+ *
+ * Allocate the data blocks needed for the file referenced by file descriptor
+ * @fd to hold @bytes bytes, without changing its size. Blocks are allocated
+ * together, as one contiguous run if there is a free one long enough, so that
+ * a file written in several steps doesn't get interleaved with other files
+ * growing at the same time.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open), or if there are not enough free blocks. 0 otherwise.
+ */
+int fs_reserve(int fd, size_t bytes);
+
 /**
  * fs_read - Read from a file
  * @fd: File descriptor
@@ -177,4 +440,328 @@ int fs_write(int fd, void *buf, size_t count);
  */
 int fs_read(int fd, void *buf, size_t count);
 
+/**
+ * fs_pread - Read from a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @offset: File offset to read from
+ *
+ * Same as fs_read(), but read from @offset instead of the file offset of file
+ * descriptor @fd, which is left unchanged. Reads don't update the sequential
+ * access detection of @fd either, so that several threads can read different
+ * parts of a file through the same descriptor at the same time.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open). Otherwise return the number of bytes actually read, 0 if @offset is
+ * at or past the end of the file.
+ */
+int fs_pread(int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_pwrite - Write to a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @offset: File offset to write at
+ *
+ * Same as fs_write(), but write at @offset instead of the file offset of file
+ * descriptor @fd, which is left unchanged. Like with fs_lseek(), @offset
+ * cannot be past the end of the file.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open) or if @offset is past the end of the file. Otherwise return the number
+ * of bytes actually written.
+ */
+int fs_pwrite(int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_readv - Read from a file into scattered buffers
+ * @fd: File descriptor
+ * @iov: Array of buffers to be filled with data
+ * @iovcnt: Number of buffers in @iov (at most %IOV_MAX)
+ *
+ * Same as fs_read(), but the data is scattered into the buffers of @iov, in
+ * order, as if they were a single buffer. Each data block is read once, even
+ * when it is shared by several buffers, and consecutive blocks are read
+ * together whatever the sizes of the buffers.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open) or if @iovcnt is invalid. Otherwise return the number of bytes
+ * actually read.
+ */
+int fs_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_writev - Write to a file from scattered buffers
+ * @fd: File descriptor
+ * @iov: Array of buffers to write in the file
+ * @iovcnt: Number of buffers in @iov (at most %IOV_MAX)
+ *
+ * Same as fs_write(), but the data is gathered from the buffers of @iov, in
+ * order, as if they were a single buffer. Each data block is written once,
+ * even when it is shared by several buffers, and consecutive blocks are
+ * written together whatever the sizes of the buffers.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open) or if @iovcnt is invalid. Otherwise return the number of bytes
+ * actually written.
+ */
+int fs_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_defrag - Defragment files
+ * @max_blocks: Number of blocks after which to stop, or 0 for no limit
+ * @max_ms: Number of milliseconds after which to stop, or 0 for no limit
+ * @stats: Structure to be filled with the outcome of the call (may be NULL)
+ *
+ * Move each file made of several extents to a free run of blocks holding it
+ * whole, until the budget given by @max_blocks and @max_ms runs out. The budget
+ * is checked between files, and a file larger than what is left of the block
+ * budget waits for the next call unless nothing was moved yet. Calls resume
+ * where the previous one stopped, so that the volume can be defragmented a
+ * little at a time between workloads. Open files are moved as well.
+ *
+ * A file is moved by copying its data to the new blocks, writing them and the
+ * new chain to disk, then pointing the root directory to the new chain and
+ * writing it, and only then releasing the old blocks. If a step fails, the file
+ * keeps its old blocks and the new ones are released. Reads and writes of the
+ * file wait until it is moved, but other files can be opened, created and
+ * deleted meanwhile.
+ *
+ * Return: -1 if no underlying virtual disk was opened or if moving a file
+ * failed. 1 if the budget ran out before every file was visited. 0 otherwise.
+ */
+int fs_defrag(size_t max_blocks, unsigned int max_ms,
+	      struct fs_defrag_stats *stats);
+
+/**
+ * fs_get_stats - Get file system counters
+ * @stats: Structure to be filled with the counters
+ *
+ * Counters start at zero when the file system is mounted, the mount itself
+ * being the first call counted. Updates go to per-thread shards of counters
+ * which are summed up here, so that they are cheap enough to be always on but
+ * only approximately consistent with each other while other threads use the
+ * file system.
+ *
+ * Return: -1 if no underlying virtual disk was opened or if @stats is NULL. 0
+ * otherwise.
+ */
+int fs_get_stats(struct fs_stats *stats);
+
+/**
+ * fs_batch - Run a batch of directory operations
+ * @items: Operations, run in order
+ * @count: Number of operations
+ *
+ * Run the operations of @items as if they were done one after the other by the
+ * matching functions, setting the result of each. The directory and the FAT
+ * are locked once for the whole batch, free root directory entries are found
+ * in a single scan, and the first blocks of the files created are spread over
+ * the largest free run, found once. Operations failing don't stop the batch.
+ *
+ * The changes of the batch are then made durable together, as by fs_sync():
+ * the data blocks written so far reach the disk first, then the FAT blocks and
+ * root directory are written once, or a single transaction is written to the
+ * metadata journal. Delayed writes still buffered for open files (see
+ * @delayed_alloc in &struct fs_options) are not written, and only become
+ * durable with the next fs_sync().
+ *
+ * Return: -1 if no underlying virtual disk was opened, if @items is NULL while
+ * @count is not 0, or if writing to the disk failed. Otherwise return the
+ * number of operations which failed.
+ */
+int fs_batch(struct fs_batch_item *items, size_t count);
+
+/**
+ * fs_mount_ex - Mount a file system and get its handle
+ * @diskname: Name of the virtual disk file
+ * @opts: Mount options, or NULL for the default ones
+ *
+ * Same as fs_mount_opts(), but the file system is independent from the one
+ * mounted by fs_mount() and from the others mounted by this function.
+ *
+ * Return: NULL if virtual disk file @diskname cannot be opened, or if no valid
+ * file system can be located. The mounted file system otherwise.
+ */
+fs_t *fs_mount_ex(const char *diskname, const struct fs_options *opts);
+
+/**
+ * fs_umount_ex - Unmount a file system mounted by fs_mount_ex()
+ * @fs: File system
+ *
+ * Same as fs_umount(). On success, @fs is released and must not be used
+ * anymore.
+ */
+int fs_umount_ex(fs_t *fs);
+
+/**
+ * fs_sync_ex - Same as fs_sync(), on file system @fs
+ * @fs: File system
+ */
+int fs_sync_ex(fs_t *fs);
+
+/**
+ * fs_cache_stats_ex - Same as fs_cache_stats(), on file system @fs
+ * @fs: File system
+ * @stats: Structure to be filled with the counters
+ */
+int fs_cache_stats_ex(fs_t *fs, struct fs_cache_stats *stats);
+
+/**
+ * fs_info_ex - Same as fs_info(), on file system @fs
+ * @fs: File system
+ */
+int fs_info_ex(fs_t *fs);
+
+/**
+ * fs_create_ex - Same as fs_create(), on file system @fs
+ * @fs: File system
+ * @filename: File name
+ */
+int fs_create_ex(fs_t *fs, const char *filename);
+
+/**
+ * fs_delete_ex - Same as fs_delete(), on file system @fs
+ * @fs: File system
+ * @filename: File name
+ */
+int fs_delete_ex(fs_t *fs, const char *filename);
+
+/**
+ * fs_ls_ex - Same as fs_ls(), on file system @fs
+ * @fs: File system
+ */
+int fs_ls_ex(fs_t *fs);
+
+/**
+ * fs_open_ex - Same as fs_open(), on file system @fs
+ * @fs: File system
+ * @filename: File name
+ *
+ * File descriptors are specific to @fs: each file system has its own
+ * %FS_OPEN_MAX_COUNT descriptors.
+ */
+int fs_open_ex(fs_t *fs, const char *filename);
+
+/**
+ * fs_close_ex - Same as fs_close(), on file system @fs
+ * @fs: File system
+ * @fd: File descriptor
+ */
+int fs_close_ex(fs_t *fs, int fd);
+
+/**
+ * fs_stat_ex - Same as fs_stat(), on file system @fs
+ * @fs: File system
+ * @fd: File descriptor
+ */
+int fs_stat_ex(fs_t *fs, int fd);
+
+/**
+ * fs_readahead_stats_ex - Same as fs_readahead_stats(), on file system @fs
+ * @fs: File system
+ * @fd: File descriptor
+ * @stats: Structure to be filled with the readahead state of @fd
+ */
+int fs_readahead_stats_ex(fs_t *fs, int fd, struct fs_readahead_stats *stats);
+
+/**
+ * fs_lseek_ex - Same as fs_lseek(), on file system @fs
+ * @fs: File system
+ * @fd: File descriptor
+ * @offset: File offset
+ */
+int fs_lseek_ex(fs_t *fs, int fd, size_t offset);
+
+/**
+ * fs_write_ex - Same as fs_write(), on file system @fs
+ * @fs: File system
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ */
+int fs_write_ex(fs_t *fs, int fd, void *buf, size_t count);
+
+/**
+ * fs_reserve_ex - Same as fs_reserve(), on file system @fs
+ * @fs: File system
+ * @fd: File descriptor
+ * @bytes: Number of bytes the file is expected to grow to
+ */
+int fs_reserve_ex(fs_t *fs, int fd, size_t bytes);
+
+/**
+ * fs_read_ex - Same as fs_read(), on file system @fs
+ * @fs: File system
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ */
+int fs_read_ex(fs_t *fs, int fd, void *buf, size_t count);
+
+/**
+ * fs_pread_ex - Same as fs_pread(), on file system @fs
+ * @fs: File system
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @offset: File offset to read from
+ */
+int fs_pread_ex(fs_t *fs, int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_pwrite_ex - Same as fs_pwrite(), on file system @fs
+ * @fs: File system
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @offset: File offset to write at
+ */
+int fs_pwrite_ex(fs_t *fs, int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_readv_ex - Same as fs_readv(), on file system @fs
+ * @fs: File system
+ * @fd: File descriptor
+ * @iov: Array of buffers to be filled with data
+ * @iovcnt: Number of buffers in @iov
+ */
+int fs_readv_ex(fs_t *fs, int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_writev_ex - Same as fs_writev(), on file system @fs
+ * @fs: File system
+ * @fd: File descriptor
+ * @iov: Array of buffers to write in the file
+ * @iovcnt: Number of buffers in @iov
+ */
+int fs_writev_ex(fs_t *fs, int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_defrag_ex - Same as fs_defrag(), on file system @fs
+ * @fs: File system
+ * @max_blocks: Number of blocks after which to stop, or 0 for no limit
+ * @max_ms: Number of milliseconds after which to stop, or 0 for no limit
+ * @stats: Structure to be filled with the outcome of the call (may be NULL)
+ */
+int fs_defrag_ex(fs_t *fs, size_t max_blocks, unsigned int max_ms,
+		 struct fs_defrag_stats *stats);
+
+/**
+ * fs_batch_ex - Same as fs_batch(), on file system @fs
+ * @fs: File system
+ * @items: Operations, run in order
+ * @count: Number of operations
+ */
+int fs_batch_ex(fs_t *fs, struct fs_batch_item *items, size_t count);
+
+/**
+ * fs_get_stats_ex - Same as fs_get_stats(), on file system @fs
+ * @fs: File system
+ * @stats: Structure to be filled with the counters
+ */
+int fs_get_stats_ex(fs_t *fs, struct fs_stats *stats);
+
 #endif /* _FS_H */
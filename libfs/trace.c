@@ -0,0 +1,211 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/*
+ * Ring of events description
+ *
+ * A ring is only written by the thread owning it. @head counts the events
+ * recorded so far: the owner fills the slot of event @head, then publishes it
+ * by incrementing @head. Rings are never freed, so that they can be dumped
+ * without locking, and the ring of a thread which exited is taken over by the
+ * next new thread.
+ */
+struct trace_ring {
+	struct trace_ring *next;
+	int owned;
+	uint32_t thread;
+	uint64_t head;
+	struct trace_event events[TRACE_RING_EVENTS];
+};
+
+static struct {
+	const char *name;
+	const char *args[3];
+} types[TRACE_TYPES] = {
+	[TRACE_DISK_READ] = { "disk_read", { "block", "count" } },
+	[TRACE_DISK_WRITE] = { "disk_write", { "block", "count" } },
+	[TRACE_ALLOC] = { "alloc", { "block", "from" } },
+	[TRACE_FREE] = { "free", { "block" } },
+	[TRACE_CHAIN_WALK] = { "chain_walk", { "block", "hops", "entry" } },
+	[TRACE_LOOKUP] = { "lookup", { "slot", "probes", "entry" } },
+	[TRACE_READ] = { "read", { "fd", "offset", "count" } },
+	[TRACE_WRITE] = { "write", { "fd", "offset", "count" } },
+	[TRACE_RUN] = { "run", { "block", "length", "bytes" } },
+	[TRACE_OP_END] = { "op_end", { "op", "ret", "us" } },
+};
+
+/* List of all the rings, only ever pushed to */
+static struct trace_ring *rings;
+
+/* Ring of the calling thread */
+static __thread struct trace_ring *thread_ring;
+
+/* Releases the ring of an exiting thread */
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static void ring_release(void *arg)
+{
+	struct trace_ring *r = arg;
+
+	__atomic_store_n(&r->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void ring_key_create(void)
+{
+	pthread_key_create(&ring_key, ring_release);
+}
+
+/* Take over a released ring, or add a new one */
+static struct trace_ring *ring_get(void)
+{
+	struct trace_ring *r;
+	int unowned;
+
+	for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+		unowned = 0;
+		if (__atomic_compare_exchange_n(&r->owned, &unowned, 1, 0,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED))
+			break;
+	}
+
+	if (!r) {
+		if (!(r = calloc(1, sizeof(*r))))
+			return NULL;
+		r->owned = 1;
+		r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&rings, &r->next, r, 0,
+						    __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED))
+			;
+	}
+	r->thread = syscall(SYS_gettid);
+
+	pthread_once(&ring_key_once, ring_key_create);
+	pthread_setspecific(ring_key, r);
+
+	return r;
+}
+
+void trace_record(unsigned int type, uint32_t a, uint32_t b, uint32_t c)
+{
+	struct trace_ring *r = thread_ring;
+	struct trace_event *e;
+	struct timespec ts;
+
+	if (!r && !(r = thread_ring = ring_get()))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	e = &r->events[r->head % TRACE_RING_EVENTS];
+	e->time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	e->thread = r->thread;
+	e->type = type;
+	e->args[0] = a;
+	e->args[1] = b;
+	e->args[2] = c;
+
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef FS_TRACE
+/* Write the events of ring @r still valid after they were copied to @f */
+static int ring_dump(struct trace_ring *r, struct trace_event *copy, FILE *f)
+{
+	struct trace_ring_header rh;
+	uint64_t head, first, valid, i;
+
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+	for (i = first; i < head; i++)
+		copy[i - first] = r->events[i % TRACE_RING_EVENTS];
+
+	/*
+	 * Events the owner recorded in the meantime overwrote the oldest ones,
+	 * and the one it may be recording now overwrites the next one
+	 */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	valid = __atomic_load_n(&r->head, __ATOMIC_RELAXED) + 1;
+	valid = valid > TRACE_RING_EVENTS ? valid - TRACE_RING_EVENTS : 0;
+	if (valid < first)
+		valid = first;
+	if (valid > head)
+		valid = head;
+
+	rh.events = head - valid;
+	if (fwrite(&rh, sizeof(rh), 1, f) != 1 ||
+	    fwrite(copy + (valid - first), sizeof(*copy), rh.events, f) !=
+	    rh.events)
+		return -1;
+
+	return 0;
+}
+
+int trace_dump(const char *path)
+{
+	struct trace_header h;
+	struct trace_event *copy;
+	struct trace_ring *first, *r;
+	FILE *f;
+	int ret = 0;
+
+	if (!(copy = malloc(TRACE_RING_EVENTS * sizeof(*copy))))
+		return -1;
+	if (!(f = fopen(path, "wb"))) {
+		free(copy);
+		return -1;
+	}
+
+	memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+	h.rings = 0;
+	h.event_size = sizeof(struct trace_event);
+
+	/* Rings added during the dump go before @first, and are left out */
+	first = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	for (r = first; r; r = r->next)
+		h.rings++;
+
+	if (fwrite(&h, sizeof(h), 1, f) != 1)
+		ret = -1;
+	for (r = first; r && !ret; r = r->next)
+		ret = ring_dump(r, copy, f);
+
+	if (fclose(f))
+		ret = -1;
+	free(copy);
+
+	return ret;
+}
+#else
+int trace_dump(const char *path)
+{
+	/* Nothing was recorded */
+	(void)path;
+	return -1;
+}
+#endif /* FS_TRACE */
+
+const char *trace_type_name(unsigned int type)
+{
+	if (type >= TRACE_TYPES)
+		return NULL;
+
+	return types[type].name;
+}
+
+const char *trace_arg_name(unsigned int type, int arg)
+{
+	if (type >= TRACE_TYPES || arg < 0 || arg > 2)
+		return NULL;
+
+	return types[type].args[arg];
+}
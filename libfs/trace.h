@@ -0,0 +1,125 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h> /* for uint32_t definition */
+
+/**
+ * enum trace_type - Events recorded by tracepoints
+ * @TRACE_DISK_READ: Blocks read from the disk (block, count, 0)
+ * @TRACE_DISK_WRITE: Blocks written to the disk (block, count, 0)
+ * @TRACE_ALLOC: Data block allocated (block, search start, 0)
+ * @TRACE_FREE: Data block released (block, 0, 0)
+ * @TRACE_CHAIN_WALK: FAT chain walked (first block, hops, file entry)
+ * @TRACE_LOOKUP: Filename looked up (hash slot, probes, file entry or -1)
+ * @TRACE_READ: fs_read() started (fd, offset, count)
+ * @TRACE_WRITE: fs_write() started (fd, offset, count)
+ * @TRACE_RUN: Run of contiguous data blocks transferred (block, length,
+ *             bytes)
+ * @TRACE_OP_END: Timed operation returned (&enum fs_op, return value,
+ *                microseconds)
+ */
+enum trace_type {
+	TRACE_DISK_READ,
+	TRACE_DISK_WRITE,
+	TRACE_ALLOC,
+	TRACE_FREE,
+	TRACE_CHAIN_WALK,
+	TRACE_LOOKUP,
+	TRACE_READ,
+	TRACE_WRITE,
+	TRACE_RUN,
+	TRACE_OP_END,
+	TRACE_TYPES,
+};
+
+/*
+ * Tracepoints are compiled in with -DFS_TRACE (`make TRACE=1`). Otherwise,
+ * TRACE() generates no code at all, its arguments being only looked at for
+ * their type.
+ */
+#ifdef FS_TRACE
+#define TRACE(type, a, b, c) \
+	trace_record(TRACE_##type, (a), (b), (c))
+#else
+#define TRACE(type, a, b, c) \
+	((void)sizeof((a) + (b) + (c)))
+#endif
+
+/**
+ * trace_record - Record an event
+ * @type: Type of the event (&enum trace_type)
+ * @a: First argument of the event
+ * @b: Second argument of the event
+ * @c: Third argument of the event
+ *
+ * Record the event, with a timestamp, in the ring of the calling thread. Each
+ * thread has its own ring of the last %TRACE_RING_EVENTS events, so recording
+ * takes no lock and never waits. Called through TRACE().
+ */
+void trace_record(unsigned int type, uint32_t a, uint32_t b, uint32_t c);
+
+/**
+ * trace_dump - Dump the recorded events to a file
+ * @path: Name of the file to be written
+ *
+ * Write the events held by the rings of every thread to @path, to be decoded
+ * with trace_decode.x. Threads can keep recording during the dump: events
+ * overwritten while they are copied are left out.
+ *
+ * Return: -1 if tracepoints are not compiled in, or if @path cannot be
+ * written. 0 otherwise.
+ */
+int trace_dump(const char *path);
+
+/**
+ * trace_type_name - Get the name of an event type
+ * @type: Type of the event
+ *
+ * Return: NULL if @type is unknown. The name of the event otherwise.
+ */
+const char *trace_type_name(unsigned int type);
+
+/**
+ * trace_arg_name - Get the name of an argument of an event type
+ * @type: Type of the event
+ * @arg: Index of the argument (0 to 2)
+ *
+ * Return: NULL if the argument is unused. Its name otherwise.
+ */
+const char *trace_arg_name(unsigned int type, int arg);
+
+/** Number of events held by the ring of each thread */
+#define TRACE_RING_EVENTS 4096
+
+/*
+ * Dump file format: a &struct trace_header, then for each ring a &struct
+ * trace_ring_header followed by its events, oldest first. Integers are in host
+ * byte order.
+ */
+#define TRACE_MAGIC "FSTRACE1"
+
+struct trace_header {
+	char magic[8];
+	uint32_t rings;
+	uint32_t event_size;
+};
+
+struct trace_ring_header {
+	uint32_t events;
+};
+
+/**
+ * struct trace_event - Recorded event
+ * @time: Time of the event in nanoseconds, from CLOCK_MONOTONIC
+ * @thread: Kernel thread ID of the thread which recorded the event
+ * @type: Type of the event (&enum trace_type)
+ * @args: Arguments of the event
+ */
+struct trace_event {
+	uint64_t time;
+	uint32_t thread;
+	uint32_t type;
+	uint32_t args[3];
+};
+
+#endif /* _TRACE_H */
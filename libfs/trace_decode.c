@@ -0,0 +1,96 @@
+/*
+ * Trace decoder
+ *
+ * Turn a dump written by trace_dump() into a timeline: the events of all the
+ * threads are merged by time and printed one per line, with their time in
+ * microseconds since the first event, the thread which recorded them, and
+ * their named arguments.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define die(fmt, ...) do { \
+	fprintf(stderr, "trace_decode: "fmt"\n", ##__VA_ARGS__); \
+	exit(1); \
+} while (0)
+
+static int by_time(const void *a, const void *b)
+{
+	const struct trace_event *x = a, *y = b;
+
+	return (x->time > y->time) - (x->time < y->time);
+}
+
+static void print_event(const struct trace_event *e, uint64_t start)
+{
+	const char *name = trace_type_name(e->type), *arg;
+	int i;
+
+	printf("%12.3f %7u ", (e->time - start) / 1e3, e->thread);
+	if (name)
+		printf("%-10s", name);
+	else
+		printf("type%-6u", e->type);
+
+	for (i = 0; i < 3; i++) {
+		if (!(arg = trace_arg_name(e->type, i)))
+			continue;
+		/* Arguments are recorded unsigned, but -1 is common */
+		printf(" %s=%d", arg, (int32_t)e->args[i]);
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_header h;
+	struct trace_ring_header rh;
+	struct trace_event *events = NULL;
+	size_t count = 0, i;
+	uint32_t r;
+	FILE *f;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: trace_decode.x dump\n");
+		exit(1);
+	}
+	if (!(f = fopen(argv[1], "rb")))
+		die("cannot open %s: %s", argv[1], strerror(errno));
+
+	if (fread(&h, sizeof(h), 1, f) != 1 ||
+	    memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)))
+		die("%s is not a trace dump", argv[1]);
+	if (h.event_size != sizeof(struct trace_event))
+		die("%s was written by another version", argv[1]);
+
+	/* Gather the events of every ring */
+	for (r = 0; r < h.rings; r++) {
+		if (fread(&rh, sizeof(rh), 1, f) != 1)
+			die("%s is truncated", argv[1]);
+		if (!rh.events)
+			continue;
+		if (!(events = realloc(events, (count + rh.events) *
+				       sizeof(*events))))
+			die("cannot allocate memory");
+		if (fread(events + count, sizeof(*events), rh.events, f) !=
+		    rh.events)
+			die("%s is truncated", argv[1]);
+		count += rh.events;
+	}
+	fclose(f);
+
+	qsort(events, count, sizeof(*events), by_time);
+
+	printf("%12s %7s %-10s args\n", "time_us", "thread", "event");
+	for (i = 0; i < count; i++)
+		print_event(&events[i], events[0].time);
+
+	free(events);
+
+	return 0;
+}